@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Runs many trackers with synthetic sources against one aggregator and reports the frames
+# per second it ingested. Every tracker samples every millisecond, i.e. ~100 frames/s each.
+# Usage: ./bench_aggregator.sh path/to/build [trackers] [cpus per tracker] [seconds]
+
+BUILD=${1:-./build}
+TRACKERS=${2:-50}
+CPUS=${3:-64}
+SECONDS_TO_RUN=${4:-10}
+SOCKET=/tmp/cut_aggregator_bench.sock
+
+"$BUILD/tracker_aggregator" --listen "unix:$SOCKET" --quiet --duration "$SECONDS_TO_RUN" &
+aggregator=$!
+sleep 0.5 # let it bind
+
+pids=()
+for i in $(seq 1 "$TRACKERS"); do
+    "$BUILD/tracker" --synthetic "$CPUS" --interval 1 --host "bench-$i" --forward "unix:$SOCKET" > /dev/null 2>&1 &
+    pids+=($!)
+done
+
+wait $aggregator # it reports on its way out
+kill -TERM "${pids[@]}" 2>/dev/null
+wait "${pids[@]}" 2>/dev/null
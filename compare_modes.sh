@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Compares the threaded and the reactor mode: context switches per second (summed over
+# all of the tracker's threads) and resident memory, after running each mode for a while.
+# Usage: ./compare_modes.sh path/to/tracker [seconds]
+
+TRACKER=${1:-./build/tracker}
+SECONDS_TO_RUN=${2:-10}
+
+ctxt_switches() {
+    cat /proc/$1/task/*/status 2>/dev/null \
+        | awk '/ctxt_switches/ { sum += $2 } END { print sum }'
+}
+
+measure() {
+    local mode=$1; shift
+    "$TRACKER" "$@" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 1 # let it settle
+    local before=$(ctxt_switches $pid)
+    sleep "$SECONDS_TO_RUN"
+    local after=$(ctxt_switches $pid)
+    local threads=$(ls /proc/$pid/task | wc -l)
+    local rss=$(awk '/VmRSS/ { print $2 }' /proc/$pid/status)
+    kill -TERM $pid
+    wait $pid 2>/dev/null
+    printf "%-9s threads: %2d  ctxt switches/s: %7.1f  RSS: %6d kB\n" \
+        "$mode" "$threads" "$(awk "BEGIN { print ($after - $before) / $SECONDS_TO_RUN }")" "$rss"
+}
+
+measure threaded
+measure reactor --reactor
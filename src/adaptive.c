@@ -0,0 +1,70 @@
+#include "adaptive.h"
+
+#include "mem.h"
+#include "util.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ADAPTIVE_CHANGE_POINTS 20.0f // a core moving this far from its recent level is a change
+#define ADAPTIVE_HOT_PERCENT   90.0f // and so is crossing this level
+#define ADAPTIVE_SMOOTHING     0.5f
+#define ADAPTIVE_MIN_TICKS     4     // fewer ticks than this between samples are just quantization noise
+
+// a base faster than the usual fast rate makes the base the fast rate as well
+void adaptive_rate_init(AdaptiveRate * const rate, const long num_cpus, const long base_micros) {
+    rate->base_micros     = base_micros;
+    rate->fast_micros     = MIN(ADAPTIVE_FAST_INTERVAL_MICROS, base_micros);
+    rate->interval_micros = rate->fast_micros; // nothing is known to be steady yet
+    rate->last            = checked_malloc((num_cpus + 1) * sizeof(CpuData));
+    rate->level           = checked_malloc((num_cpus + 1) * sizeof(float));
+    rate->have_last       = false;
+    rate->calm            = 0;
+    for (long i = 0; i <= num_cpus; ++i)
+        rate->level[i] = 0;
+}
+
+void adaptive_rate_destroy(AdaptiveRate * const rate) {
+    free(rate->last);
+    free(rate->level);
+}
+
+static bool core_changed(AdaptiveRate * const rate, const long i, const CpuData * const prev, const CpuData * const curr) {
+    if (!prev->online || !curr->online)
+        return false;
+    cpu_time_t prev_idle  = prev->idle + prev->io_wait;
+    cpu_time_t curr_idle  = curr->idle + curr->io_wait;
+    cpu_time_t prev_total = prev_idle + prev->user + prev->nice + prev->system + prev->irq + prev->soft_irq + prev->steal;
+    cpu_time_t curr_total = curr_idle + curr->user + curr->nice + curr->system + curr->irq + curr->soft_irq + curr->steal;
+    if (curr_total < prev_total + ADAPTIVE_MIN_TICKS || curr_idle < prev_idle || curr_total - prev_total < curr_idle - prev_idle)
+        return false;
+
+    float usage = 100.0f * ((curr_total - prev_total) - (curr_idle - prev_idle)) / (curr_total - prev_total);
+    float level = rate->level[i];
+    rate->level[i] += (usage - level) * ADAPTIVE_SMOOTHING;
+    return (usage > level ? usage - level : level - usage) > ADAPTIVE_CHANGE_POINTS
+        || (usage >= ADAPTIVE_HOT_PERCENT) != (level >= ADAPTIVE_HOT_PERCENT);
+}
+
+// a sample's timestamp is what keeps the averages right whatever the spacing
+long adaptive_rate_update(AdaptiveRate * const rate, const CpuDataSample * const sample) {
+    bool changed = false;
+    if (rate->have_last)
+        for (long i = 1; i < sample->length; ++i)
+            changed |= core_changed(rate, i, rate->last + i, sample->cpu_data + i);
+    memcpy(rate->last, sample->cpu_data, sample->length * sizeof(CpuData));
+    rate->have_last = true;
+
+    long next = rate->interval_micros;
+    if (changed) {
+        next       = rate->fast_micros;
+        rate->calm = 0;
+    } else if (++rate->calm >= ADAPTIVE_HOLD_SAMPLES) {
+        next = MIN(2 * rate->interval_micros, rate->base_micros);
+    }
+    if (next != rate->interval_micros)
+        stat_inc(STAT_RATE_CHANGES);
+    rate->interval_micros = next;
+    return next;
+}
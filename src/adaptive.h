@@ -0,0 +1,27 @@
+#pragma once
+
+// The --adaptive sampling rate: it jumps to the fast rate on any change of a core's usage, holds it for a
+// while and then halves it step by step back to the base. Fed every sample, it tells how long to wait for
+// the next one.
+
+#include "reader.h"
+
+#include <stdbool.h>
+
+#define ADAPTIVE_FAST_INTERVAL_MICROS 50000  // while the usage moves
+#define ADAPTIVE_BASE_INTERVAL_MICROS 500000 // while it doesn't
+#define ADAPTIVE_HOLD_SAMPLES         20     // samples at the fast rate after the last change, before slowing down
+
+typedef struct {
+    long base_micros;     // the slowest rate, while nothing changes
+    long fast_micros;     // right after a change
+    long interval_micros; // the current one
+    CpuData* last;        // the previous sample, to tell what happened since
+    float* level;         // every core's recent usage
+    bool have_last;
+    unsigned calm;        // samples since the last change
+} AdaptiveRate;
+
+void adaptive_rate_init(AdaptiveRate * const rate, const long num_cpus, const long base_micros);
+void adaptive_rate_destroy(AdaptiveRate * const rate);
+long adaptive_rate_update(AdaptiveRate * const rate, const CpuDataSample * const sample); // the next interval
@@ -0,0 +1,247 @@
+#include "aggregator.h"
+
+#include "mem.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 64 // a power of two, and doubled whenever the table gets 3/4 full
+#define ANSI_CLEAR    "\x1b[2J\x1b[H"
+
+typedef struct {
+    char name[FRAME_MAX_HOST_LEN + 1];
+    float* values;         // the latest frame's, the total first
+    uint32_t num_values;
+    uint64_t next_seq;
+    uint64_t frames;
+    uint64_t frames_lost;
+    uint64_t frames_at_print; // for the rate since the last print
+    int64_t last_seen_millis;
+} Host;
+
+struct Aggregator {
+    Host** slots;          // open addressing, NULL for a free slot
+    size_t num_slots;
+    size_t num_hosts;
+    Host** scratch;        // room for every host, to sort or to sift through
+    size_t scratch_len;
+    uint64_t frames;
+    uint64_t frames_lost;
+    uint64_t frames_refused;
+    int64_t last_print_millis;
+};
+
+static uint64_t hash_name(const char * const name) {
+    uint64_t hash = 14695981039346656037u; // fnv-1a
+    for (const char* c = name; *c; ++c)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211u;
+    return hash;
+}
+
+static Host** find_slot(Host ** const slots, const size_t num_slots, const char * const name) {
+    size_t i = hash_name(name) & (num_slots - 1);
+    while (slots[i] && strcmp(slots[i]->name, name) != 0)
+        i = (i + 1) & (num_slots - 1);
+    return slots + i;
+}
+
+static void grow(Aggregator * const aggregator) {
+    const size_t num_slots = 2 * aggregator->num_slots;
+    Host** slots = checked_malloc(num_slots * sizeof(Host*));
+    for (size_t i = 0; i < num_slots; ++i)
+        slots[i] = NULL;
+    for (size_t i = 0; i < aggregator->num_slots; ++i)
+        if (aggregator->slots[i])
+            *find_slot(slots, num_slots, aggregator->slots[i]->name) = aggregator->slots[i];
+    free(aggregator->slots);
+    aggregator->slots     = slots;
+    aggregator->num_slots = num_slots;
+}
+
+Aggregator* new_aggregator() {
+    Aggregator* aggregator = checked_malloc(sizeof(*aggregator));
+    aggregator->slots             = checked_malloc(INITIAL_SLOTS * sizeof(Host*));
+    aggregator->num_slots         = INITIAL_SLOTS;
+    aggregator->num_hosts         = 0;
+    aggregator->scratch           = NULL;
+    aggregator->scratch_len       = 0;
+    aggregator->frames            = 0;
+    aggregator->frames_lost       = 0;
+    aggregator->frames_refused    = 0;
+    aggregator->last_print_millis = 0;
+    for (size_t i = 0; i < INITIAL_SLOTS; ++i)
+        aggregator->slots[i] = NULL;
+    return aggregator; // don't forget to free!
+}
+
+// NULL for a new host once there are MAX_HOSTS - anyone who can connect can make up names
+static Host* get_host(Aggregator * const aggregator, const char * const name) {
+    Host** slot = find_slot(aggregator->slots, aggregator->num_slots, name);
+    if (*slot)
+        return *slot;
+    if (aggregator->num_hosts >= MAX_HOSTS)
+        return NULL;
+    if (4 * (aggregator->num_hosts + 1) > 3 * aggregator->num_slots) {
+        grow(aggregator);
+        slot = find_slot(aggregator->slots, aggregator->num_slots, name);
+    }
+    Host* host = checked_malloc(sizeof(*host));
+    strcpy(host->name, name);
+    host->values          = NULL;
+    host->num_values      = 0;
+    host->next_seq        = 0;
+    host->frames          = 0;
+    host->frames_lost     = 0;
+    host->frames_at_print = 0;
+    *slot = host;
+    aggregator->num_hosts++;
+    return host;
+}
+
+// a sequence going back means the tracker was restarted, which isn't a loss
+void aggregator_ingest(Aggregator * const aggregator, const Frame * const frame, const int64_t now_millis) {
+    Host* host = get_host(aggregator, frame->host);
+    if (!host) {
+        aggregator->frames_refused++;
+        return;
+    }
+    if (host->frames > 0 && frame->seq > host->next_seq) {
+        host->frames_lost       += frame->seq - host->next_seq;
+        aggregator->frames_lost += frame->seq - host->next_seq;
+    }
+    if (frame->num_values != host->num_values) {
+        free(host->values);
+        host->values     = checked_malloc(MAX(frame->num_values, 1) * sizeof(float));
+        host->num_values = frame->num_values;
+    }
+    memcpy(host->values, frame->values, frame->num_values * sizeof(float));
+    host->next_seq         = frame->seq + 1;
+    host->last_seen_millis = now_millis;
+    host->frames++;
+    aggregator->frames++;
+}
+
+// every host, in no particular order, taken out of the table if asked to
+static Host** collect_hosts(Aggregator * const aggregator, const bool take) {
+    if (aggregator->scratch_len < aggregator->num_hosts) {
+        aggregator->scratch_len = MAX(aggregator->num_hosts, 2 * aggregator->scratch_len);
+        aggregator->scratch     = checked_realloc(aggregator->scratch, aggregator->scratch_len * sizeof(Host*));
+    }
+    for (size_t i = 0, n = 0; i < aggregator->num_slots; ++i)
+        if (aggregator->slots[i]) {
+            aggregator->scratch[n++] = aggregator->slots[i];
+            if (take)
+                aggregator->slots[i] = NULL;
+        }
+    return aggregator->scratch;
+}
+
+static void free_host(Host * const host) {
+    free(host->values);
+    free(host);
+}
+
+// forgets the hosts that haven't reported for HOST_EVICT_MILLIS and puts the rest back, which
+// also clears the probe chains of the ones that are gone
+size_t aggregator_evict(Aggregator * const aggregator, const int64_t now_millis) {
+    Host** hosts = collect_hosts(aggregator, true);
+    const size_t num_hosts = aggregator->num_hosts;
+    for (size_t i = 0; i < num_hosts; ++i) {
+        if (now_millis - hosts[i]->last_seen_millis > HOST_EVICT_MILLIS) {
+            free_host(hosts[i]);
+            aggregator->num_hosts--;
+        } else {
+            *find_slot(aggregator->slots, aggregator->num_slots, hosts[i]->name) = hosts[i];
+        }
+    }
+    return num_hosts - aggregator->num_hosts;
+}
+
+static inline bool is_live(const Host * const host, const int64_t now_millis) {
+    return now_millis - host->last_seen_millis <= HOST_STALE_MILLIS && host->num_values > 0 && host->values[0] >= 0;
+}
+
+// the fleet's mean weighs every host by its number of cpus
+FleetSummary aggregator_summary(const Aggregator * const aggregator, const int64_t now_millis) {
+    FleetSummary summary = {
+        .hosts          = 0,
+        .cpus           = 0,
+        .mean_usage     = 0,
+        .max_host_usage = 0,
+        .busiest_host   = NULL,
+        .frames         = aggregator->frames,
+        .frames_lost    = aggregator->frames_lost,
+        .frames_refused = aggregator->frames_refused,
+    };
+    double sum = 0;
+    for (size_t i = 0; i < aggregator->num_slots; ++i) {
+        const Host* host = aggregator->slots[i];
+        if (!host || !is_live(host, now_millis))
+            continue;
+        const size_t cpus = MAX(host->num_values - 1, 1u);
+        summary.hosts++;
+        summary.cpus += cpus;
+        sum += (double)host->values[0] * cpus;
+        if (!summary.busiest_host || host->values[0] > summary.max_host_usage) {
+            summary.max_host_usage = host->values[0];
+            summary.busiest_host   = host->name;
+        }
+    }
+    summary.mean_usage = summary.cpus ? sum / summary.cpus : 0;
+    return summary;
+}
+
+static int compare_hosts(const void* a, const void* b) {
+    return strcmp((*(const Host**)a)->name, (*(const Host**)b)->name);
+}
+
+static float hottest_cpu(const Host * const host, uint32_t * const cpu) {
+    float hottest = -1;
+    for (uint32_t i = 1; i < host->num_values; ++i)
+        if (host->values[i] > hottest) {
+            hottest = host->values[i];
+            *cpu    = i - 1;
+        }
+    return hottest;
+}
+
+// the fleet first, then every host by name, with its rate since the previous print
+void print_fleet(Aggregator * const aggregator, FILE * const stream, const int64_t now_millis) {
+    const FleetSummary summary = aggregator_summary(aggregator, now_millis);
+    const double elapsed = aggregator->last_print_millis ? (now_millis - aggregator->last_print_millis) / 1000.0 : 0;
+    aggregator->last_print_millis = now_millis;
+
+    Host** hosts = collect_hosts(aggregator, false);
+    const size_t num_hosts = aggregator->num_hosts;
+    qsort(hosts, num_hosts, sizeof(Host*), compare_hosts);
+
+    checked_fprintf(stream, ANSI_CLEAR);
+    checked_fprintf(stream, "fleet: %zu hosts, %zu cpus, %.1f%% mean, busiest %s at %.1f%% | %llu frames, %llu lost\n",
+        summary.hosts, summary.cpus, summary.mean_usage, summary.busiest_host ? summary.busiest_host : "-",
+        summary.max_host_usage, (unsigned long long)summary.frames, (unsigned long long)summary.frames_lost);
+    for (size_t i = 0; i < num_hosts; ++i) {
+        Host* host = hosts[i];
+        const double rate = elapsed > 0 ? (host->frames - host->frames_at_print) / elapsed : 0;
+        host->frames_at_print = host->frames;
+        if (!is_live(host, now_millis)) {
+            checked_fprintf(stream, "  %-24s stale for %.1f s\n", host->name, (now_millis - host->last_seen_millis) / 1000.0);
+            continue;
+        }
+        uint32_t cpu = 0;
+        float hottest = hottest_cpu(host, &cpu);
+        checked_fprintf(stream, "  %-24s %4u cpus  total %5.1f%%  hottest cpu%-4u %5.1f%%  %6.1f frames/s  %llu lost\n",
+            host->name, MAX(host->num_values, 1u) - 1, host->values[0], cpu, MAX(hottest, 0.0f), rate,
+            (unsigned long long)host->frames_lost);
+    }
+    fflush(stream);
+}
+
+void destroy_aggregator(Aggregator * const aggregator) {
+    for (size_t i = 0; i < aggregator->num_slots; ++i)
+        if (aggregator->slots[i])
+            free_host(aggregator->slots[i]);
+    free(aggregator->slots);
+    free(aggregator->scratch);
+    free(aggregator);
+}
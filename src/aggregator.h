@@ -0,0 +1,33 @@
+#pragma once
+
+// Merges the frames of any number of forwarding trackers into the latest usage per host and a
+// fleet-wide view over every host that has reported recently.
+
+#include "frame.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HOST_STALE_MILLIS 5000   // a host that hasn't reported for this long is left out of the fleet
+#define HOST_EVICT_MILLIS 300000 // and forgotten altogether after this long
+#define MAX_HOSTS         4096   // the frames of any more hosts are refused until some are evicted
+
+typedef struct {
+    size_t hosts;          // the live ones
+    size_t cpus;           // on the live hosts
+    float mean_usage;      // over every cpu of the live hosts
+    float max_host_usage;
+    const char* busiest_host;
+    uint64_t frames;       // ingested so far, from any host
+    uint64_t frames_lost;  // going by the gaps in the senders' sequences
+    uint64_t frames_refused; // from new hosts while there were MAX_HOSTS already
+} FleetSummary;
+
+typedef struct Aggregator Aggregator;
+
+Aggregator* new_aggregator();
+void aggregator_ingest(Aggregator * const aggregator, const Frame * const frame, const int64_t now_millis);
+size_t aggregator_evict(Aggregator * const aggregator, const int64_t now_millis);
+FleetSummary aggregator_summary(const Aggregator * const aggregator, const int64_t now_millis);
+void print_fleet(Aggregator * const aggregator, FILE * const stream, const int64_t now_millis);
+void destroy_aggregator(Aggregator * const aggregator);
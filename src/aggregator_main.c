@@ -0,0 +1,295 @@
+#define _GNU_SOURCE // accept4
+
+#include "aggregator.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "clock.h"
+#include "frame.h"
+#include "net.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define DEFAULT_ADDR         "9463"
+#define DEFAULT_PRINT_MILLIS 1000
+#define LISTEN_BACKLOG       256
+#define MAX_EVENTS           64
+
+static const char * const usage_text =
+    "Usage: %s [OPTION]...\n"
+    "Collects the usage streamed by trackers running with --forward, per host and fleet-wide.\n"
+    "  -l, --listen ADDR   accept trackers on unix:PATH, a localhost PORT or HOST:PORT, e.g. 0.0.0.0:" DEFAULT_ADDR "\n"
+    "                      for every interface (default: " DEFAULT_ADDR ")\n"
+    "  -i, --interval MS   print the fleet every MS milliseconds (default: 1000)\n"
+    "  -q, --quiet         don't print the fleet, just the totals on the way out\n"
+    "  -d, --duration SECS stop after SECS seconds, e.g. for a benchmark\n"
+    "  -h, --help          display this help and exit\n";
+
+static const struct option long_options[] = {
+    {"listen",   required_argument, NULL, 'l'},
+    {"interval", required_argument, NULL, 'i'},
+    {"quiet",    no_argument,       NULL, 'q'},
+    {"duration", required_argument, NULL, 'd'},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL,       0,                 NULL,  0 },
+};
+
+typedef struct {
+    const char* addr;
+    long print_millis;
+    bool quiet;
+    long duration_millis; // 0 to run until signalled
+} AggregatorOptions;
+
+// the frames of one tracker, read into the buffer and decoded as soon as they're complete
+typedef struct Connection {
+    int fd;
+    struct Connection* prev; // all of them on a list, to let go of on the way out
+    struct Connection* next;
+    size_t fill;
+    uint8_t buffer[2 * FRAME_MAX_LEN];
+} Connection;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    int timer_fd;
+    int signal_fd;
+    char* unix_path;      // NULL unless listening on a unix socket
+    Connection* connections;
+    Aggregator* aggregator;
+    Frame frame;          // decoded into, one at a time
+} Server;
+
+// the epoll data of everything that isn't a connection
+static char listen_tag, timer_tag, signal_tag;
+
+static AggregatorOptions parse_options(const int argc, char * const argv[]) {
+    AggregatorOptions options = {
+        .addr            = DEFAULT_ADDR,
+        .print_millis    = DEFAULT_PRINT_MILLIS,
+        .quiet           = false,
+        .duration_millis = 0,
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:i:qd:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'l':
+                options.addr = optarg;
+                break;
+            case 'i':
+                options.print_millis = parse_long_option(optarg, 1, 3600000, usage_text, argv[0]);
+                break;
+            case 'q':
+                options.quiet = true;
+                break;
+            case 'd':
+                options.duration_millis = parse_long_option(optarg, 1, 86400, usage_text, argv[0]) * 1000;
+                break;
+            case 'h':
+                printf(usage_text, argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, usage_text, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    return options;
+}
+
+// like the exporter, only open to other machines when given their interface's address (or a wildcard) -
+// there's no telling trackers from anyone else who connects
+static int listen_tcp(const char * const addr) {
+    char host[256];
+    const char* port = split_host_port(addr, host, sizeof(host));
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    struct addrinfo* result;
+    int res = getaddrinfo(host[0] ? host : "127.0.0.1", port, &hints, &result);
+    if (res != 0) {
+        errno = 0; // not a system error
+        vfatal("failed to resolve %s: %s", addr, gai_strerror(res));
+    }
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        fatal("socket");
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(fd, result->ai_addr, result->ai_addrlen) < 0)
+        vfatal("bind %s", addr);
+    freeaddrinfo(result);
+    return fd;
+}
+
+static void watch(Server * const server, const int fd, void * const tag) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = tag};
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        fatal("epoll_ctl");
+}
+
+static int new_timer_fd(const long interval_millis) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        fatal("timerfd_create");
+    struct itimerspec spec = {
+        .it_interval = {.tv_sec = interval_millis / 1000, .tv_nsec = interval_millis % 1000 * 1000000L},
+        .it_value    = {.tv_sec = interval_millis / 1000, .tv_nsec = interval_millis % 1000 * 1000000L},
+    };
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+        fatal("timerfd_settime");
+    return fd;
+}
+
+static void new_server(Server * const server, const AggregatorOptions * const options) {
+    server->unix_path = NULL;
+    const char* path = unix_socket_path(options->addr);
+    if (path) {
+        server->unix_path = strdup(path);
+        server->listen_fd = listen_unix(server->unix_path);
+    } else {
+        server->listen_fd = listen_tcp(options->addr);
+    }
+    if (listen(server->listen_fd, LISTEN_BACKLOG) < 0)
+        fatal("listen");
+    if ((server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        fatal("epoll_create1");
+    server->timer_fd        = new_timer_fd(options->print_millis);
+    server->signal_fd       = new_signal_fd();
+    server->connections     = NULL;
+    server->aggregator      = new_aggregator();
+    watch(server, server->listen_fd, &listen_tag);
+    watch(server, server->timer_fd, &timer_tag);
+    watch(server, server->signal_fd, &signal_tag);
+}
+
+static void accept_connections(Server * const server) {
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Connection* conn = checked_malloc(sizeof(*conn));
+        conn->fd   = fd;
+        conn->fill = 0;
+        conn->prev = NULL;
+        conn->next = server->connections;
+        if (conn->next)
+            conn->next->prev = conn;
+        server->connections = conn;
+        watch(server, fd, conn);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+        fatal("accept4");
+}
+
+static void close_connection(Server * const server, Connection * const conn) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        server->connections = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    free(conn);
+}
+
+// false if the stream is garbage
+static bool decode_frames(Server * const server, Connection * const conn, const int64_t now_millis) {
+    size_t pos = 0;
+    long length;
+    while ((length = decode_frame(conn->buffer + pos, conn->fill - pos, &server->frame)) > 0) {
+        aggregator_ingest(server->aggregator, &server->frame, now_millis);
+        pos += length;
+    }
+    memmove(conn->buffer, conn->buffer + pos, conn->fill - pos); // the start of a frame still on its way
+    conn->fill -= pos;
+    return length != FRAME_INVALID;
+}
+
+// an incomplete frame is always shorter than FRAME_MAX_LEN, so there's room for the next read
+static void handle_connection(Server * const server, Connection * const conn) {
+    const int64_t now_millis = monotonic_millis();
+    ssize_t nread;
+    while ((nread = read(conn->fd, conn->buffer + conn->fill, sizeof(conn->buffer) - conn->fill)) > 0) {
+        conn->fill += nread;
+        if (!decode_frames(server, conn, now_millis)) {
+            fprintf(stderr, "[Aggregator] dropping a connection that doesn't speak the frame protocol\n");
+            close_connection(server, conn);
+            return;
+        }
+    }
+    if (nread == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        close_connection(server, conn); // the tracker went away, it will reconnect if it's still around
+}
+
+static void destroy_server(Server * const server) {
+    while (server->connections) // there's nothing more to read from them
+        close_connection(server, server->connections);
+    close(server->signal_fd);
+    close(server->timer_fd);
+    close(server->epoll_fd);
+    close(server->listen_fd);
+    if (server->unix_path) {
+        unlink(server->unix_path);
+        free(server->unix_path);
+    }
+    destroy_aggregator(server->aggregator);
+}
+
+int main(int argc, char* argv[]) {
+    AggregatorOptions options = parse_options(argc, argv);
+    Server* server = checked_malloc(sizeof(*server));
+    new_server(server, &options);
+    const int64_t started = monotonic_millis();
+    fprintf(stderr, "[Aggregator] listening on %s\n", options.addr);
+
+    bool running = true;
+    while (running) {
+        struct epoll_event events[MAX_EVENTS];
+        int nready = epoll_wait(server->epoll_fd, events, MAX_EVENTS, -1);
+        if (nready < 0 && errno != EINTR)
+            fatal("epoll_wait");
+        for (int i = 0; i < nready; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_connections(server);
+            } else if (tag == &timer_tag) {
+                uint64_t expirations;
+                if (read(server->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    fatal("read");
+                const int64_t now_millis = monotonic_millis();
+                aggregator_evict(server->aggregator, now_millis);
+                if (!options.quiet)
+                    print_fleet(server->aggregator, stdout, now_millis);
+                if (options.duration_millis && now_millis - started >= options.duration_millis)
+                    running = false;
+            } else if (tag == &signal_tag) {
+                fprintf(stderr, "Received a termination signal. Shutting down...\n");
+                running = false;
+            } else {
+                handle_connection(server, tag);
+            }
+        }
+    }
+
+    const double seconds = (monotonic_millis() - started) / 1000.0;
+    const FleetSummary summary = aggregator_summary(server->aggregator, monotonic_millis());
+    fprintf(stderr, "[Aggregator] ingested %llu frames from %zu hosts in %.1f s: %.1f frames/s, %llu lost, %llu refused\n",
+        (unsigned long long)summary.frames, summary.hosts, seconds, summary.frames / seconds,
+        (unsigned long long)summary.frames_lost, (unsigned long long)summary.frames_refused);
+    destroy_server(server);
+    free(server);
+    return 0;
+}
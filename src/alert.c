@@ -0,0 +1,367 @@
+#include "alert.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "stats.h"
+#include "net.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORD_LEN   16
+#define MAX_EVENT_LEN  256
+#define MAX_RULE_TEXT  128 // of a rule's text quoted in an event, keeping the whole line within MAX_EVENT_LEN
+
+typedef struct {
+    int64_t pending_since; // when the condition started holding, -1 if it doesn't
+    int64_t quiet_until;   // the end of the cooldown after the last resolve
+    bool firing;
+} AlertState;
+
+struct AlertEngine {
+    AlertRule rules[MAX_ALERT_RULES];
+    AlertState* all_states;              // one per rule and target, in a single allocation
+    AlertState* states[MAX_ALERT_RULES]; // where each rule's states begin
+    long num_targets[MAX_ALERT_RULES];
+    size_t num_rules;
+    const CpuTopology* topology;
+    int fd;
+    bool is_socket;
+    char unsent[MAX_EVENT_LEN]; // the tail of an event the socket only took part of, finished before the next
+    size_t unsent_len;
+    size_t unsent_pos;
+};
+
+static const struct {
+    const char* name;
+    long millis;
+} duration_units[] = {
+    {"ms", 1}, {"s", 1000}, {"sec", 1000}, {"m", 60000}, {"min", 60000}, {"h", 3600000},
+};
+
+static void skip_spaces(const char ** const pos) {
+    while (isspace((unsigned char)**pos))
+        ++*pos;
+}
+
+// a word is only consumed when the caller accepts it, hence the separate peek
+static size_t peek_word(const char * const pos, char * const word) {
+    size_t len = 0;
+    while (isalpha((unsigned char)pos[len]) && len < MAX_WORD_LEN) {
+        word[len] = pos[len];
+        ++len;
+    }
+    word[len] = '\0';
+    return len;
+}
+
+static bool parse_percent(const char ** const pos, float * const value) {
+    skip_spaces(pos);
+    char* end;
+    *value = strtof(*pos, &end);
+    if (end == *pos || *value < 0 || *value > 100)
+        return false;
+    *pos = end;
+    skip_spaces(pos);
+    if (**pos == '%')
+        ++*pos;
+    return true;
+}
+
+// seconds unless there's a unit, which may be separated by a space ("10 s", "1min")
+static bool parse_duration(const char ** const pos, long * const millis) {
+    skip_spaces(pos);
+    char* end;
+    double value = strtod(*pos, &end);
+    if (end == *pos || value < 0)
+        return false;
+    *pos = end;
+    skip_spaces(pos);
+
+    char word[MAX_WORD_LEN + 1];
+    size_t len = peek_word(*pos, word);
+    long unit = 1000;
+    for (size_t i = 0; i < sizeof(duration_units) / sizeof(duration_units[0]); ++i) {
+        if (strcasecmp(word, duration_units[i].name) == 0) {
+            unit  = duration_units[i].millis;
+            *pos += len;
+        }
+    }
+    *millis = (long)(value * unit);
+    return true;
+}
+
+static bool parse_metric(const char * const word, AlertRule * const rule) {
+    if (strcasecmp(word, "total") == 0) {
+        rule->metric = ALERT_TOTAL;
+        return true;
+    }
+    if (strcasecmp(word, "cpu") == 0) {
+        rule->metric = ALERT_CPU;
+        return true;
+    }
+    if (strcasecmp(word, "steal") == 0) {
+        rule->metric = ALERT_STEAL;
+        return true;
+    }
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        if (strcasecmp(word, topo_level_names[level]) == 0) {
+            rule->metric = ALERT_GROUP;
+            rule->level  = level;
+            return true;
+        }
+    }
+    return false;
+}
+
+// METRIC (>|<) PERCENT [for DURATION] [clear PERCENT] [cooldown DURATION]
+// where METRIC is total, cpu, steal or a topology level (node, socket, core, llc)
+bool parse_alert_rule(const char * const text, AlertRule * const rule) {
+    const char* pos = text;
+    char word[MAX_WORD_LEN + 1];
+    memset(rule, 0, sizeof(*rule));
+    rule->text            = text;
+    rule->cooldown_millis = ALERT_DEFAULT_COOLDOWN_MILLIS;
+
+    skip_spaces(&pos);
+    pos += peek_word(pos, word);
+    if (!parse_metric(word, rule))
+        return false;
+    skip_spaces(&pos);
+    if (*pos != '>' && *pos != '<')
+        return false;
+    rule->above = *pos++ == '>';
+    if (!parse_percent(&pos, &rule->threshold))
+        return false;
+    rule->clear_threshold = rule->above
+        ? rule->threshold * (1 - ALERT_DEFAULT_HYSTERESIS)
+        : MIN(100.0f, rule->threshold * (1 + ALERT_DEFAULT_HYSTERESIS));
+
+    for (skip_spaces(&pos); *pos; skip_spaces(&pos)) {
+        pos += peek_word(pos, word);
+        bool ok = false;
+        if (strcasecmp(word, "for") == 0)
+            ok = parse_duration(&pos, &rule->for_millis);
+        else if (strcasecmp(word, "clear") == 0)
+            ok = parse_percent(&pos, &rule->clear_threshold);
+        else if (strcasecmp(word, "cooldown") == 0)
+            ok = parse_duration(&pos, &rule->cooldown_millis);
+        if (!ok)
+            return false;
+    }
+    // the clear threshold has to be on the quiet side, or the alert would flap
+    return rule->above ? rule->clear_threshold <= rule->threshold : rule->clear_threshold >= rule->threshold;
+}
+
+static int connect_unix(const char * const path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        fatal("socket");
+    struct sockaddr_un addr;
+    unix_socket_addr(path, &addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        vfatal("failed to connect to %s", path);
+    return fd;
+}
+
+// a file to append to, a listening unix socket ("unix:PATH"), or stderr when NULL
+int open_alert_sink(const char * const addr) {
+    if (!addr) {
+        int fd = dup(STDERR_FILENO);
+        if (fd < 0)
+            fatal("dup");
+        return fd;
+    }
+    const char* path = unix_socket_path(addr);
+    if (path)
+        return connect_unix(path);
+    int fd = open(addr, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        vfatal("failed to open %s", addr);
+    return fd;
+}
+
+static long targets_for(const AlertRule * const rule, const CpuTopology * const topology) {
+    switch (rule->metric) {
+        case ALERT_TOTAL:
+            return 1;
+        case ALERT_CPU:
+        case ALERT_STEAL:
+            return topology->num_cpus;
+        case ALERT_GROUP:
+            return topology->num_groups[rule->level];
+    }
+    return 0;
+}
+
+// takes ownership of the fd
+AlertEngine* new_alert_engine(const AlertRule * const rules, const size_t num_rules, const CpuTopology * const topology, const int fd) {
+    if (num_rules > MAX_ALERT_RULES)
+        fatal("too many alert rules");
+    AlertEngine* engine = checked_malloc(sizeof(*engine));
+    engine->num_rules = num_rules;
+    engine->topology  = topology;
+    engine->fd        = fd;
+    int type;
+    socklen_t type_len = sizeof(type);
+    engine->is_socket  = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0;
+    engine->unsent_len = 0;
+    engine->unsent_pos = 0;
+
+    long total_targets = 0;
+    for (size_t i = 0; i < num_rules; ++i) {
+        engine->rules[i]       = rules[i];
+        engine->num_targets[i] = targets_for(rules + i, topology);
+        total_targets         += engine->num_targets[i];
+    }
+    AlertState* states = engine->all_states = checked_malloc(MAX(total_targets, 1) * sizeof(AlertState));
+    for (long i = 0; i < total_targets; ++i)
+        states[i] = (AlertState){.pending_since = -1, .quiet_until = 0, .firing = false};
+    for (size_t i = 0; i < num_rules; states += engine->num_targets[i++])
+        engine->states[i] = states;
+    return engine;
+}
+
+static size_t target_name(const AlertEngine * const engine, const AlertRule * const rule, const long target,
+    char * const buffer, const size_t max_len) {
+    switch (rule->metric) {
+        case ALERT_TOTAL:
+            return checked_snprintf(buffer, max_len, "total");
+        case ALERT_CPU:
+        case ALERT_STEAL:
+            return checked_snprintf(buffer, max_len, "cpu%ld", target);
+        case ALERT_GROUP:
+            return checked_snprintf(buffer, max_len, "%s%d", topo_level_names[rule->level],
+                engine->topology->group_id[rule->level][target]);
+    }
+    return 0;
+}
+
+// true once nothing is left of the last event
+static bool flush_unsent(AlertEngine * const engine) {
+    while (engine->unsent_pos < engine->unsent_len) {
+        ssize_t nwritten = engine->is_socket // a stuck listener mustn't stall the pipeline
+            ? send(engine->fd, engine->unsent + engine->unsent_pos, engine->unsent_len - engine->unsent_pos, MSG_NOSIGNAL | MSG_DONTWAIT)
+            : write(engine->fd, engine->unsent + engine->unsent_pos, engine->unsent_len - engine->unsent_pos);
+        if (nwritten < 0 && engine->is_socket && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (nwritten < 0) { // the listener is gone, there's no finishing this one
+            engine->unsent_pos = engine->unsent_len;
+            stat_inc(STAT_ALERT_EVENTS_LOST);
+            return true;
+        }
+        engine->unsent_pos += nwritten;
+    }
+    return true;
+}
+
+// one logfmt line per event, written in one go so that concurrent readers never see half of it; should
+// the socket take only part of it, the rest goes out before anything else, and the events that come
+// while it's stuck are dropped rather than glued onto a torn line
+static void emit(AlertEngine * const engine, const AlertRule * const rule, const long target,
+    const cpu_usage_t value, const char * const state) {
+    if (!flush_unsent(engine)) {
+        stat_inc(STAT_ALERT_EVENTS_LOST);
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct tm tm;
+    gmtime_r(&now.tv_sec, &tm);
+
+    char* event = engine->unsent;
+    const size_t max_len = sizeof(engine->unsent);
+    size_t pos = strftime(event, max_len, "time=%Y-%m-%dT%H:%M:%S", &tm);
+    pos += checked_snprintf(event + pos, max_len - pos, ".%03ldZ state=%s target=", now.tv_nsec / 1000000, state);
+    pos += target_name(engine, rule, target, event + pos, max_len - pos);
+    pos += checked_snprintf(event + pos, max_len - pos, " value=%.1f rule=\"%.*s\"\n", value, MAX_RULE_TEXT, rule->text);
+
+    engine->unsent_len = pos;
+    engine->unsent_pos = 0;
+    flush_unsent(engine);
+}
+
+// returns whether an event was emitted
+static bool step(AlertEngine * const engine, const AlertRule * const rule, AlertState * const state,
+    const long target, const cpu_usage_t value, const int64_t now_millis) {
+    if (state->firing) {
+        if (rule->above ? value > rule->clear_threshold : value < rule->clear_threshold)
+            return false;
+        state->firing      = false;
+        state->quiet_until = now_millis + rule->cooldown_millis;
+        emit(engine, rule, target, value, "resolved");
+        return true;
+    }
+    if (rule->above ? value <= rule->threshold : value >= rule->threshold) {
+        state->pending_since = -1;
+        return false;
+    }
+    if (state->pending_since < 0)
+        state->pending_since = now_millis;
+    if (now_millis - state->pending_since < rule->for_millis || now_millis < state->quiet_until)
+        return false;
+    state->firing        = true;
+    state->pending_since = -1;
+    stat_inc(STAT_ALERTS_FIRED);
+    emit(engine, rule, target, value, "firing");
+    return true;
+}
+
+// a constant amount of work per rule and target, nothing is allocated unless an event fires; the durations
+// go by now_millis, which is the end of the usage's window on the monotonic clock rather than when it got here
+size_t alerts_evaluate(AlertEngine * const engine, const CpuUsage * const usage, const int64_t now_millis) {
+    flush_unsent(engine); // whatever's left of the last event, even if nothing new comes of this usage
+    size_t num_events = 0;
+    for (size_t i = 0; i < engine->num_rules; ++i) {
+        const AlertRule* rule = engine->rules + i;
+        const cpu_usage_t* values = NULL;
+        long length = 0;
+        switch (rule->metric) {
+            case ALERT_TOTAL:
+                values = usage->usage;
+                length = MIN(usage->length, 1);
+                break;
+            case ALERT_CPU:
+                values = usage->usage + 1;
+                length = usage->length - 1;
+                break;
+            case ALERT_STEAL:
+                values = usage->steal ? usage->steal + 1 : NULL;
+                length = usage->steal ? usage->length - 1 : 0;
+                break;
+            case ALERT_GROUP:
+                values = usage->group_usage[rule->level];
+                length = usage->num_groups[rule->level];
+                break;
+        }
+
+        AlertState* states = engine->states[i];
+        length = MIN(length, engine->num_targets[i]);
+        for (long target = 0; target < length; ++target) {
+            if (values[target] == UNKNOWN_USAGE) {
+                states[target].pending_since = -1; // a gap restarts the clock, but doesn't resolve anything
+                continue;
+            }
+            num_events += step(engine, rule, states + target, target, values[target], now_millis);
+        }
+    }
+    return num_events;
+}
+
+void destroy_alert_engine(AlertEngine * const engine) {
+    if (!flush_unsent(engine)) // one last chance for an event that's stuck halfway
+        stat_inc(STAT_ALERT_EVENTS_LOST);
+    if (close(engine->fd) < 0)
+        fatal("close");
+    free(engine->all_states);
+    free(engine);
+}
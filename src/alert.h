@@ -0,0 +1,41 @@
+#pragma once
+
+// Threshold rules such as "cpu > 95 for 10s" or "node > 80 for 1min", evaluated incrementally on every
+// usage snapshot with O(1) state per rule and target. A firing alert only resolves once the value is
+// back past the rule's clear threshold, and stays quiet for a cooldown afterwards.
+
+#include "analyzer.h"
+#include "topology.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_ALERT_RULES               16
+#define ALERT_DEFAULT_HYSTERESIS      0.1f  // relative to the threshold, unless a rule says "clear"
+#define ALERT_DEFAULT_COOLDOWN_MILLIS 10000
+
+typedef enum {
+    ALERT_TOTAL, // the system-wide usage
+    ALERT_CPU,   // every cpu
+    ALERT_STEAL, // every cpu's share of time stolen by the hypervisor
+    ALERT_GROUP, // every group on a topology level
+} alert_metric_t;
+
+typedef struct {
+    const char* text; // as written, for the events
+    alert_metric_t metric;
+    topo_level_t level; // for ALERT_GROUP
+    bool above;         // "> threshold" rather than "< threshold"
+    float threshold;
+    float clear_threshold;
+    long for_millis;
+    long cooldown_millis;
+} AlertRule;
+
+typedef struct AlertEngine AlertEngine;
+
+bool parse_alert_rule(const char * const text, AlertRule * const rule);
+int open_alert_sink(const char * const addr);
+AlertEngine* new_alert_engine(const AlertRule * const rules, const size_t num_rules, const CpuTopology * const topology, const int fd);
+size_t alerts_evaluate(AlertEngine * const engine, const CpuUsage * const usage, const int64_t now_millis);
+void destroy_alert_engine(AlertEngine * const engine);
@@ -6,51 +6,257 @@
 #include <stddef.h>
 #include <assert.h>
 
-static cpu_usage_t get_usage_for_core(const unsigned core, const CpuDataSample * const samples) {
+static inline bool is_online(const unsigned core, const CpuDataSample * const sample) {
+    return sample->length - 1 >= core && sample->cpu_data[core].online;
+}
+
+// averages over the sample pairs where the core was online - a hotplug in the middle
+// of the window shortens it instead of throwing the whole window away; every pair
+// counts for as long as it lasted, as the sampling rate may have changed in between
+static void get_usage_for_core(const unsigned core, const CpuDataSample * const samples,
+    cpu_usage_t * const usage, cpu_usage_t * const steal, cpu_usage_t * const self) {
     assert(NUM_SAMPLES > 1);
-    for (size_t i = 0; i < NUM_SAMPLES; ++i)
-        if (samples[i].length - 1 < core || !samples[i].cpu_data[core].online)
-            return UNKNOWN_USAGE;
+    cpu_usage_t sum_usage = 0;
+    cpu_usage_t sum_steal = 0;
+    cpu_usage_t sum_self  = 0;
+    cpu_usage_t sum_weights = 0;
 
-    cpu_time_t idle[NUM_SAMPLES], non_idle[NUM_SAMPLES], total[NUM_SAMPLES];
+    for (size_t i = 1; i < NUM_SAMPLES; ++i) {
+        if (!is_online(core, samples + i - 1) || !is_online(core, samples + i))
+            continue;
+        const CpuData* prev = &samples[i - 1].cpu_data[core];
+        const CpuData* curr = &samples[i].cpu_data[core];
+        cpu_time_t prev_idle  = prev->idle + prev->io_wait;
+        cpu_time_t curr_idle  = curr->idle + curr->io_wait;
+        cpu_time_t prev_total = prev_idle + prev->user + prev->nice + prev->system + prev->irq + prev->soft_irq + prev->steal;
+        cpu_time_t curr_total = curr_idle + curr->user + curr->nice + curr->system + curr->irq + curr->soft_irq + curr->steal;
 
-    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
-        CpuData* data = &samples[i].cpu_data[core];
-        idle[i]     = data->idle + data->io_wait;
-        non_idle[i] = data->user + data->nice + data->system + data->irq + data->soft_irq + data->steal;
-        total[i]    = idle[i] + non_idle[i];
+        cpu_time_t delta_total = curr_total - prev_total;
+        cpu_time_t delta_idle  = curr_idle  - prev_idle;
+        if (curr_total <= prev_total || curr_idle < prev_idle || delta_total < delta_idle || curr->steal < prev->steal)
+            continue; // nothing ticked (or the counters went back after a re-online)
+        cpu_usage_t weight = samples[i].timestamp_nanos > samples[i - 1].timestamp_nanos
+            ? (samples[i].timestamp_nanos - samples[i - 1].timestamp_nanos) / 1e6f // in millis, plenty for a float
+            : 1.0f; // no timestamps, so evenly spaced
+        sum_usage   += weight * (delta_total - delta_idle) / delta_total;
+        sum_steal   += weight * (curr->steal - prev->steal) / delta_total;
+        sum_self    += weight * (curr->self - prev->self) / delta_total;
+        sum_weights += weight;
     }
+    *usage = sum_weights == 0 ? UNKNOWN_USAGE : sum_usage / sum_weights * 100.0f;
+    *steal = sum_weights == 0 ? UNKNOWN_USAGE : sum_steal / sum_weights * 100.0f;
+    *self  = sum_weights == 0 ? UNKNOWN_USAGE : sum_self  / sum_weights * 100.0f;
+}
 
-    cpu_usage_t avg_usage = 0;
-    for (size_t i = 1; i < NUM_SAMPLES; ++i) {
-        cpu_time_t delta_total = total[i] - total[i - 1];
-        cpu_time_t delta_idle  = idle[i]  - idle[i - 1];
-        assert(delta_total >= delta_idle);
-        assert(delta_total > 0);
-        cpu_usage_t usage = (cpu_usage_t)(delta_total - delta_idle) / (cpu_usage_t)delta_total;
-        avg_usage += usage / (NUM_SAMPLES - 1);
+// the three arrays start on cache lines of their own, so that shards writing neighbouring cores don't collide
+CpuUsage new_usage(const long length, const bool observed) {
+    const long stride = (length + CPUS_PER_CACHE_LINE - 1) / CPUS_PER_CACHE_LINE * CPUS_PER_CACHE_LINE;
+    CpuUsage usage = {
+        .usage    = checked_aligned_malloc(CACHE_LINE, 3 * stride * sizeof(cpu_usage_t)), // the steal and self shares come right after
+        .length   = length,
+        .topology = NULL,
+        .irq      = NULL,
+        .window_start_nanos = 0,
+        .window_end_nanos   = 0,
+    };
+    usage.steal = usage.usage + stride;
+    usage.self  = observed ? usage.steal + stride : NULL;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        usage.group_usage[level] = NULL;
+        usage.num_groups[level]  = 0;
     }
-    return avg_usage * 100.0f;
+    return usage; // don't forget to free!
 }
 
-CpuUsage get_usage(CpuDataSample * const samples) {
+void get_window(CpuUsage * const usage, const CpuDataSample * const samples) {
+    usage->window_start_nanos = samples[0].timestamp_nanos;
+    usage->window_end_nanos   = samples[NUM_SAMPLES - 1].timestamp_nanos;
+}
+
+long usage_length(const CpuDataSample * const samples) {
     long max_len = 0;
-    
     for (long i = 0; i < NUM_SAMPLES; ++i)
         max_len = MAX(max_len, samples[i].length);
-    
-    CpuUsage usage = {
-        .usage  = checked_malloc(max_len * sizeof(cpu_usage_t)),
-        .length = max_len,
-    };
+    return max_len;
+}
+
+static float per_sec(const unsigned long long first, const unsigned long long last, const uint64_t nanos) {
+    return nanos > 0 && last >= first ? (last - first) * 1e9f / nanos : UNKNOWN_USAGE;
+}
+
+// the counters' deltas over the whole batch, the instantaneous ones averaged over the samples actually read
+void get_sched_usage(CpuUsage * const usage, const CpuDataSample * const samples) {
+    const SchedData* first = &samples[0].sched;
+    const SchedData* last  = &samples[NUM_SAMPLES - 1].sched;
+    const uint64_t nanos   = samples[NUM_SAMPLES - 1].timestamp_nanos - samples[0].timestamp_nanos;
+    SchedUsage* sched = &usage->sched;
+    unsigned long sum_running = 0;
+    unsigned long sum_blocked = 0;
+    unsigned num_read = 0;
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        if (samples[i].filled)
+            continue;
+        sum_running += samples[i].sched.procs_running;
+        sum_blocked += samples[i].sched.procs_blocked;
+        num_read++;
+    }
+    long online = 0;
+    for (long cpu = 1; cpu < samples[NUM_SAMPLES - 1].length; ++cpu)
+        online += samples[NUM_SAMPLES - 1].cpu_data[cpu].online;
+
+    sched->ctxt_per_sec    = per_sec(first->ctxt, last->ctxt, nanos);
+    sched->procs_running   = (float)sum_running / num_read; // the first and the last are always read
+    sched->procs_blocked   = (float)sum_blocked / num_read;
+    sched->running_per_cpu = online ? sched->procs_running / online : UNKNOWN_USAGE;
+    sched->psi             = first->psi && last->psi;
+    const bool full        = sched->psi && first->psi_full && last->psi_full;
+    sched->some_avg10      = sched->psi ? last->some_avg10 : UNKNOWN_USAGE;
+    sched->some_avg60      = sched->psi ? last->some_avg60 : UNKNOWN_USAGE;
+    sched->full_avg10      = full ? last->full_avg10 : UNKNOWN_USAGE;
+    sched->full_avg60      = full ? last->full_avg60 : UNKNOWN_USAGE;
+    // micros stalled per second, over ten thousand for a percentage
+    sched->some_stall      = sched->psi ? per_sec(first->some_total, last->some_total, nanos) / 1e4f : UNKNOWN_USAGE;
+    sched->full_stall      = full ? per_sec(first->full_total, last->full_total, nanos) / 1e4f : UNKNOWN_USAGE;
+}
+
+// keeps a cpu's busiest sources sorted, the rest of them fall off the end
+static void rank_source(IrqRate * const top, const uint32_t source, const float rate) {
+    size_t rank = IRQ_TOP_SOURCES;
+    while (rank > 0 && rate > top[rank - 1].rate) {
+        if (rank < IRQ_TOP_SOURCES)
+            top[rank] = top[rank - 1];
+        --rank;
+    }
+    if (rank < IRQ_TOP_SOURCES)
+        top[rank] = (IrqRate){.source = source, .rate = rate};
+}
 
-    for (long i = 0; i < usage.length; ++i)
-        usage.usage[i] = get_usage_for_core(i, samples);
+// the busiest interrupt lines and softirqs of every cpu, going by the batch's first and last counts;
+// a batch over which the sources changed has no breakdown
+void get_irq_usage(CpuUsage * const usage, const CpuDataSample * const samples) {
+    const IrqSnapshot* first = samples[0].irq;
+    const IrqSnapshot* last  = samples[NUM_SAMPLES - 1].irq;
+    if (!first || !last || first->layout != last->layout)
+        return;
+    const uint64_t nanos = samples[NUM_SAMPLES - 1].timestamp_nanos - samples[0].timestamp_nanos;
+    const float per_nano = nanos > 0 ? 1e9f / nanos : 0;
+    const size_t num_sources = last->layout->num_sources;
 
+    IrqUsage* irq = checked_malloc(sizeof(*irq));
+    irq->layout   = irq_layout_ref(last->layout);
+    irq->num_cpus = last->num_cpus;
+    irq->top      = checked_malloc(MAX(irq->num_cpus, 1) * IRQ_TOP_SOURCES * sizeof(IrqRate));
+    for (long cpu = 0; cpu < irq->num_cpus; ++cpu) {
+        IrqRate* top = irq->top + cpu * IRQ_TOP_SOURCES;
+        for (size_t rank = 0; rank < IRQ_TOP_SOURCES; ++rank)
+            top[rank] = (IrqRate){.source = 0, .rate = 0};
+        const uint32_t* before = first->counts + cpu * num_sources;
+        const uint32_t* after  = last->counts + cpu * num_sources;
+        for (size_t source = 0; source < num_sources; ++source)
+            if (after[source] != before[source])
+                rank_source(top, source, (uint32_t)(after[source] - before[source]) * per_nano); // the kernel's counts wrap
+    }
+    usage->irq = irq;
+}
+
+void get_usage_range(CpuUsage * const usage, const CpuDataSample * const samples, const long begin, const long end) {
+    cpu_usage_t self;
+    for (long i = begin; i < end; ++i)
+        get_usage_for_core(i, samples, usage->usage + i, usage->steal + i, usage->self ? usage->self + i : &self);
+}
+
+CpuUsage get_usage(CpuDataSample * const samples) {
+    CpuUsage usage = new_usage(usage_length(samples), samples[0].observed);
+    get_usage_range(&usage, samples, 0, usage.length);
+    get_window(&usage, samples);
+    get_sched_usage(&usage, samples);
+    get_irq_usage(&usage, samples);
     free_samples(samples);
     return usage; // don't forget to free!
 }
 
+long total_groups(const CpuTopology * const topology) {
+    long total = 0;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        total += topology->num_groups[level];
+    return total;
+}
+
+// the groups of every level one after another, as in the sums of accumulate_groups
+static void group_offsets(const CpuTopology * const topology, size_t * const offset) {
+    for (size_t level = 0, pos = 0; level < NUM_TOPO_LEVELS; pos += topology->num_groups[level++])
+        offset[level] = pos;
+}
+
+// adds the usage entries from begin to end to the sums and counts of their groups
+void accumulate_groups(const CpuUsage * const usage, const CpuTopology * const topology, const long begin, const long end,
+    cpu_usage_t * const sums, unsigned * const counts) {
+    size_t offset[NUM_TOPO_LEVELS];
+    group_offsets(topology, offset);
+    long last = MIN(end, MIN(usage->length, topology->num_cpus + 1));
+    for (long i = MAX(begin, 1); i < last; ++i) { // entry 0 is the total
+        cpu_usage_t cpu_usage = usage->usage[i];
+        if (cpu_usage == UNKNOWN_USAGE)
+            continue;
+        for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+            int group = topology->group_of[level][i - 1];
+            if (group < 0)
+                continue;
+            sums[offset[level] + group] += cpu_usage;
+            counts[offset[level] + group]++;
+        }
+    }
+}
+
+// turns the sums into averages, which the usage then owns
+void finish_groups(CpuUsage * const usage, const CpuTopology * const topology, cpu_usage_t * const sums, const unsigned * const counts) {
+    size_t offset[NUM_TOPO_LEVELS];
+    group_offsets(topology, offset);
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        usage->group_usage[level] = sums + offset[level];
+        usage->num_groups[level]  = topology->num_groups[level];
+    }
+    for (long i = 0; i < total_groups(topology); ++i)
+        sums[i] = counts[i] ? sums[i] / counts[i] : UNKNOWN_USAGE;
+    usage->topology = topology;
+}
+
+// one pass over the cores, the topology's index maps tell where each of them belongs
+void aggregate_usage(CpuUsage * const usage, const CpuTopology * const topology) {
+    const long num_groups = total_groups(topology);
+    if (num_groups == 0)
+        return;
+
+    cpu_usage_t* sums = checked_malloc(num_groups * sizeof(cpu_usage_t));
+    unsigned counts[num_groups];
+    for (long i = 0; i < num_groups; ++i) {
+        sums[i]   = 0;
+        counts[i] = 0;
+    }
+    accumulate_groups(usage, topology, 0, usage->length, sums, counts);
+    finish_groups(usage, topology, sums, counts);
+}
+
+// the tracker's own time is charged to the cpu it ran on last, which may occasionally
+// overshoot what that cpu was busy with, hence the clamping
+void subtract_self_range(CpuUsage * const usage, const long begin, const long end) {
+    if (!usage->self)
+        return;
+    for (long i = begin; i < end; ++i)
+        if (usage->usage[i] != UNKNOWN_USAGE)
+            usage->usage[i] = MAX(0.0f, usage->usage[i] - usage->self[i]);
+}
+
+void subtract_self_usage(CpuUsage * const usage) {
+    subtract_self_range(usage, 0, usage->length);
+}
+
 void free_usage(CpuUsage usage) {
-    free(usage.usage);    
+    free(usage.usage); // along with the steal and self shares
+    free(usage.group_usage[0]); // all levels share one allocation
+    if (usage.irq) {
+        irq_layout_unref(usage.irq->layout);
+        free(usage.irq->top);
+        free(usage.irq);
+    }
 }
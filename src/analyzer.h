@@ -1,15 +1,58 @@
 #pragma once
 
 #include "reader.h"
+#include "topology.h"
+#include "mem.h"
 
-#define UNKNOWN_USAGE (-1.0f)
+#define UNKNOWN_USAGE       (-1.0f)
+#define CPUS_PER_CACHE_LINE (CACHE_LINE / sizeof(cpu_usage_t))
 
 typedef float cpu_usage_t;
 
+// how contended the cpus were over the batch, UNKNOWN_USAGE where the samples don't tell - system-wide
+// only, /proc/stat and /proc/pressure keep no run queue per cpu
+typedef struct {
+    float ctxt_per_sec;
+    float procs_running;    // averaged over the batch's samples
+    float procs_blocked;
+    float running_per_cpu;  // past 1 the runnable tasks queue up for the online cpus
+    bool psi;
+    float some_avg10;       // the kernel's averages as of the batch's last sample
+    float some_avg60;
+    float full_avg10;       // the full_* are UNKNOWN_USAGE on kernels without a "full" line
+    float full_avg60;
+    float some_stall;       // the percent of the batch's time some task waited for a cpu
+    float full_stall;
+} SchedUsage;
+
 typedef struct {
     cpu_usage_t* usage;
+    cpu_usage_t* steal; // the share of time stolen by the hypervisor, indexed like usage
+    cpu_usage_t* self;  // the tracker's own share, indexed like usage, NULL unless observed
     long length;
+    const CpuTopology* topology; // not owned, NULL unless aggregated
+    cpu_usage_t* group_usage[NUM_TOPO_LEVELS];
+    long num_groups[NUM_TOPO_LEVELS];
+    SchedUsage sched;
+    IrqUsage* irq;      // NULL unless irqs are tracked
+    uint64_t window_start_nanos; // the monotonic times of the batch's first and last samples, which
+    uint64_t window_end_nanos;   // are what the usage is over - the adaptive sampler stretches and shrinks it
 } CpuUsage;
 
 CpuUsage get_usage(CpuDataSample * const samples);
+void aggregate_usage(CpuUsage * const usage, const CpuTopology * const topology);
+void subtract_self_usage(CpuUsage * const usage);
+
+// the pieces of the above, for analyzing a batch in shards
+CpuUsage new_usage(const long length, const bool observed);
+long usage_length(const CpuDataSample * const samples);
+void get_window(CpuUsage * const usage, const CpuDataSample * const samples);
+void get_sched_usage(CpuUsage * const usage, const CpuDataSample * const samples);
+void get_irq_usage(CpuUsage * const usage, const CpuDataSample * const samples);
+void get_usage_range(CpuUsage * const usage, const CpuDataSample * const samples, const long begin, const long end);
+void subtract_self_range(CpuUsage * const usage, const long begin, const long end);
+long total_groups(const CpuTopology * const topology);
+void accumulate_groups(const CpuUsage * const usage, const CpuTopology * const topology, const long begin, const long end,
+    cpu_usage_t * const sums, unsigned * const counts);
+void finish_groups(CpuUsage * const usage, const CpuTopology * const topology, cpu_usage_t * const sums, const unsigned * const counts);
 void free_usage(CpuUsage usage);
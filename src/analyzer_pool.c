@@ -0,0 +1,169 @@
+#include "analyzer_pool.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "pthread_util.h"
+
+#include <string.h>
+
+// everything a shard writes to during a batch, on cache lines nobody else writes to
+typedef struct {
+    _Alignas(CACHE_LINE) pthread_t thread;
+    AnalyzerPool* pool;
+    long begin;
+    long end;
+    cpu_usage_t* sums;  // partial, for the shard's own cpus
+    unsigned* counts;
+} Shard;
+
+struct AnalyzerPool {
+    Shard shards[MAX_ANALYZER_THREADS]; // the first one is run by the caller itself
+    size_t num_shards;
+    const CpuTopology* topology;
+    long num_groups;
+    pthread_mutex_t mtx;
+    pthread_cond_t work_cnd;
+    pthread_cond_t done_cnd;
+    unsigned long batch;  // bumped for every batch, what the shards wait for
+    size_t pending;       // shards yet to finish the current batch
+    bool stopping;
+    // the current batch, only touched under the mutex or between a bump of batch and pending reaching 0
+    const CpuDataSample* samples;
+    CpuUsage* usage;
+    bool subtract_self;
+};
+
+static void analyze_shard(Shard * const shard) {
+    AnalyzerPool* pool = shard->pool;
+    get_usage_range(pool->usage, pool->samples, shard->begin, shard->end);
+    if (pool->subtract_self)
+        subtract_self_range(pool->usage, shard->begin, shard->end);
+    for (long i = 0; i < pool->num_groups; ++i) {
+        shard->sums[i]   = 0;
+        shard->counts[i] = 0;
+    }
+    if (pool->num_groups > 0)
+        accumulate_groups(pool->usage, pool->topology, shard->begin, shard->end, shard->sums, shard->counts);
+}
+
+static void* shard_work(void* arg) {
+    Shard* shard = (Shard*)arg;
+    AnalyzerPool* pool = shard->pool;
+    unsigned long seen = 0;
+
+    mtx_lock(&pool->mtx);
+    while (true) {
+        while (!pool->stopping && pool->batch == seen)
+            cnd_wait(&pool->work_cnd, &pool->mtx);
+        if (pool->stopping)
+            break;
+        seen = pool->batch;
+        mtx_unlock(&pool->mtx);
+
+        analyze_shard(shard);
+
+        mtx_lock(&pool->mtx);
+        if (--pool->pending == 0)
+            cnd_signal(&pool->done_cnd);
+    }
+    mtx_unlock(&pool->mtx);
+    return NULL;
+}
+
+AnalyzerPool* new_analyzer_pool(const size_t num_threads, const CpuTopology * const topology, const pthread_attr_t * const attr) {
+    if (num_threads == 0 || num_threads > MAX_ANALYZER_THREADS)
+        fatal("invalid number of analyzer threads");
+    AnalyzerPool* pool = checked_aligned_malloc(CACHE_LINE, sizeof(*pool));
+    pool->num_shards = num_threads;
+    pool->topology   = topology;
+    pool->num_groups = total_groups(topology);
+    pool->batch      = 0;
+    pool->pending    = 0;
+    pool->stopping   = false;
+    mtx_init(&pool->mtx);
+    cnd_init(&pool->work_cnd);
+    cnd_init(&pool->done_cnd);
+
+    // rounded up to whole cache lines of the usage arrays
+    const size_t sums_len   = (pool->num_groups * sizeof(cpu_usage_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    const size_t counts_len = (pool->num_groups * sizeof(unsigned) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    for (size_t i = 0; i < pool->num_shards; ++i) {
+        Shard* shard  = pool->shards + i;
+        shard->pool   = pool;
+        shard->sums   = checked_aligned_malloc(CACHE_LINE, MAX(sums_len, CACHE_LINE));
+        shard->counts = checked_aligned_malloc(CACHE_LINE, MAX(counts_len, CACHE_LINE));
+        if (i > 0)
+            thr_spawn(&shard->thread, shard_work, shard, attr);
+    }
+    return pool; // don't forget to destroy!
+}
+
+// whole cache lines of cpus for every shard, the last one gets whatever is left
+static void assign_ranges(AnalyzerPool * const pool, const long length) {
+    long lines     = (length + CPUS_PER_CACHE_LINE - 1) / CPUS_PER_CACHE_LINE;
+    long per_shard = (lines + pool->num_shards - 1) / pool->num_shards * CPUS_PER_CACHE_LINE;
+    for (size_t i = 0; i < pool->num_shards; ++i) {
+        pool->shards[i].begin = MIN(length, (long)i * per_shard);
+        pool->shards[i].end   = MIN(length, (long)(i + 1) * per_shard);
+    }
+}
+
+// consumes the samples, the usage is aggregated and to be freed by the caller
+CpuUsage pool_analyze(AnalyzerPool * const pool, CpuDataSample * const samples, const bool subtract_self) {
+    CpuUsage usage = new_usage(usage_length(samples), samples[0].observed);
+
+    mtx_lock(&pool->mtx);
+    pool->samples       = samples;
+    pool->usage         = &usage;
+    pool->subtract_self = subtract_self;
+    assign_ranges(pool, usage.length);
+    pool->pending = pool->num_shards - 1;
+    pool->batch++;
+    PTHREAD_CHECK(pthread_cond_broadcast, pthread_cond_broadcast(&pool->work_cnd));
+    mtx_unlock(&pool->mtx);
+
+    analyze_shard(pool->shards); // the caller's share
+
+    mtx_lock(&pool->mtx);
+    while (pool->pending > 0)
+        cnd_wait(&pool->done_cnd, &pool->mtx);
+    mtx_unlock(&pool->mtx);
+    get_window(&usage, samples);
+    get_sched_usage(&usage, samples); // a handful of numbers, not worth a shard
+    get_irq_usage(&usage, samples);
+    free_samples(samples);
+
+    if (pool->num_groups == 0)
+        return usage;
+    cpu_usage_t* sums = checked_malloc(pool->num_groups * sizeof(cpu_usage_t));
+    unsigned counts[pool->num_groups];
+    memcpy(sums, pool->shards[0].sums, pool->num_groups * sizeof(cpu_usage_t));
+    memcpy(counts, pool->shards[0].counts, pool->num_groups * sizeof(unsigned));
+    for (size_t i = 1; i < pool->num_shards; ++i) {
+        for (long group = 0; group < pool->num_groups; ++group) {
+            sums[group]   += pool->shards[i].sums[group];
+            counts[group] += pool->shards[i].counts[group];
+        }
+    }
+    finish_groups(&usage, pool->topology, sums, counts);
+    return usage; // don't forget to free!
+}
+
+void destroy_analyzer_pool(AnalyzerPool * const pool) {
+    mtx_lock(&pool->mtx);
+    pool->stopping = true;
+    PTHREAD_CHECK(pthread_cond_broadcast, pthread_cond_broadcast(&pool->work_cnd));
+    mtx_unlock(&pool->mtx);
+
+    for (size_t i = 0; i < pool->num_shards; ++i) {
+        if (i > 0)
+            thr_join(pool->shards[i].thread, NULL);
+        free(pool->shards[i].sums);
+        free(pool->shards[i].counts);
+    }
+    cnd_destroy(&pool->done_cnd);
+    cnd_destroy(&pool->work_cnd);
+    mtx_destroy(&pool->mtx);
+    free(pool);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Splits the analysis of every batch across a fixed set of threads, each of them owning a contiguous,
+// cache-line aligned range of cpus and its own partial group sums. Batches are analyzed one at a time,
+// so the usage comes out in the order the batches went in.
+
+#include "analyzer.h"
+#include "topology.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define MAX_ANALYZER_THREADS 64
+
+typedef struct AnalyzerPool AnalyzerPool;
+
+AnalyzerPool* new_analyzer_pool(const size_t num_threads, const CpuTopology * const topology, const pthread_attr_t * const attr);
+CpuUsage pool_analyze(AnalyzerPool * const pool, CpuDataSample * const samples, const bool subtract_self);
+void destroy_analyzer_pool(AnalyzerPool * const pool);
@@ -0,0 +1,112 @@
+#include "bus.h"
+
+#include "err.h"
+#include "mem.h"
+#include "stats.h"
+#include "pthread_util.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static void shared_usage_unref(SharedUsage * const shared) {
+    if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) == 1) {
+        free_usage(shared->usage);
+        free(shared);
+    }
+}
+
+void bus_init(UsageBus * const bus) {
+    bus->num_subscribers = 0;
+    atomic_init(&bus->published, 0);
+}
+
+// the subscribers' workers are gone by now, whatever is left in their queues is released here
+void bus_destroy(UsageBus * const bus) {
+    for (size_t i = 0; i < bus->num_subscribers; ++i) {
+        Subscriber* sub = bus->subscribers + i;
+        while (!queue_empty(&sub->worker->job_queue)) {
+            shared_usage_unref(*(SharedUsage**)queue_front(&sub->worker->job_queue));
+            queue_pop_front(&sub->worker->job_queue);
+        }
+        if (sub->notify_fd >= 0 && close(sub->notify_fd) < 0)
+            fatal("close");
+    }
+    bus->num_subscribers = 0;
+}
+
+Subscriber* bus_subscribe(UsageBus * const bus, const char * const name, WorkerCtx * const worker,
+    const size_t max_lag, const bool notify) {
+    if (bus->num_subscribers == MAX_SUBSCRIBERS)
+        fatal("too many subscribers");
+    Subscriber* sub = bus->subscribers + bus->num_subscribers++;
+    sub->name      = name;
+    sub->worker    = worker;
+    sub->max_lag   = max_lag;
+    sub->notify_fd = -1;
+    if (notify && (sub->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        fatal("eventfd");
+    atomic_init(&sub->consumed, 0);
+    atomic_init(&sub->dropped, 0);
+    return sub;
+}
+
+static void notify(const Subscriber * const sub) {
+    if (sub->notify_fd >= 0) {
+        uint64_t one = 1;
+        if (write(sub->notify_fd, &one, sizeof(one)) < 0)
+            fatal("write");
+    }
+}
+
+static void deliver(Subscriber * const sub, SharedUsage * const shared) {
+    WorkerCtx* worker = sub->worker;
+    mtx_lock(&worker->mtx);
+    queue_push_back(&worker->job_queue, &shared);
+    while (sub->max_lag && worker->job_queue.num_items > sub->max_lag) {
+        // a slow subscriber only loses its own oldest snapshots, nobody else waits for it
+        shared_usage_unref(*(SharedUsage**)queue_front(&worker->job_queue));
+        queue_pop_front(&worker->job_queue);
+        atomic_fetch_add_explicit(&sub->dropped, 1, memory_order_relaxed);
+        stat_inc(STAT_SNAPSHOTS_DROPPED);
+    }
+    worker->wait = false;
+    cnd_signal(&worker->cnd);
+    mtx_unlock(&worker->mtx);
+
+    notify(sub);
+}
+
+// takes ownership of the usage, which must not be touched by the publisher afterwards
+void bus_publish(UsageBus * const bus, const CpuUsage usage) {
+    if (bus->num_subscribers == 0) {
+        free_usage(usage);
+        return;
+    }
+    SharedUsage* shared = checked_malloc(sizeof(*shared));
+    shared->usage = usage;
+    atomic_init(&shared->refs, bus->num_subscribers); // one reference per subscriber, no copies
+    atomic_fetch_add_explicit(&bus->published, 1, memory_order_relaxed);
+    for (size_t i = 0; i < bus->num_subscribers; ++i)
+        deliver(bus->subscribers + i, shared);
+}
+
+// the publisher is done - every subscriber still gets what's in its queue, and then stops
+void bus_close(UsageBus * const bus) {
+    for (size_t i = 0; i < bus->num_subscribers; ++i) {
+        Subscriber* sub = bus->subscribers + i;
+        order_termination(sub->worker);
+        notify(sub);
+    }
+}
+
+void subscriber_release(Subscriber * const sub, SharedUsage * const shared) {
+    atomic_fetch_add_explicit(&sub->consumed, 1, memory_order_relaxed);
+    shared_usage_unref(shared);
+}
+
+// how many published snapshots the subscriber has yet to get to
+uint64_t subscriber_lag(const UsageBus * const bus, const Subscriber * const sub) {
+    return atomic_load_explicit(&bus->published, memory_order_relaxed)
+         - atomic_load_explicit(&sub->consumed, memory_order_relaxed)
+         - atomic_load_explicit(&sub->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Fans the analyzer's output out to any number of consumers. Every snapshot is published once,
+// immutable and reference-counted, and freed when the last subscriber is done with it.
+
+#include "analyzer.h"
+#include "worker.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define MAX_SUBSCRIBERS 8
+
+typedef struct {
+    atomic_uint refs;
+    CpuUsage usage;
+} SharedUsage;
+
+typedef struct {
+    const char* name;
+    WorkerCtx* worker;      // its job queue holds SharedUsage*
+    size_t max_lag;         // 0 means unbounded, otherwise the oldest snapshots are dropped
+    int notify_fd;          // an eventfd for event loops, -1 for workers waiting on their condition
+    _Atomic uint64_t consumed;
+    _Atomic uint64_t dropped;
+} Subscriber;
+
+typedef struct {
+    Subscriber subscribers[MAX_SUBSCRIBERS];
+    size_t num_subscribers;
+    _Atomic uint64_t published;
+} UsageBus;
+
+void bus_init(UsageBus * const bus);
+void bus_destroy(UsageBus * const bus);
+Subscriber* bus_subscribe(UsageBus * const bus, const char * const name, WorkerCtx * const worker, 
+    const size_t max_lag, const bool notify);
+void bus_publish(UsageBus * const bus, const CpuUsage usage);
+void bus_close(UsageBus * const bus);
+void subscriber_release(Subscriber * const sub, SharedUsage * const shared);
+uint64_t subscriber_lag(const UsageBus * const bus, const Subscriber * const sub);
@@ -0,0 +1,55 @@
+#include "clock.h"
+
+#include "err.h"
+#include "pthread_util.h"
+
+#include <string.h>
+
+static struct {
+    pthread_mutex_t mtx;
+    time_t seconds;   // what the prefix was formatted for, -1 before the first one
+    size_t length;
+    char prefix[WALL_CLOCK_PREFIX_LEN + 1];
+} cache = {.mtx = PTHREAD_MUTEX_INITIALIZER, .seconds = -1}; // a singleton instance
+
+uint64_t monotonic_nanos() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        fatal("clock_gettime");
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+int64_t monotonic_millis() {
+    return monotonic_nanos() / 1000000;
+}
+
+uint64_t realtime_nanos() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0)
+        fatal("clock_gettime");
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// the wall clock time at which the monotonic clock read the given nanos, now for the ones it hasn't got to yet
+uint64_t realtime_of(const uint64_t monotonic) {
+    const uint64_t wall = realtime_nanos();
+    const uint64_t now  = monotonic_nanos();
+    return monotonic < now && now - monotonic < wall ? wall - (now - monotonic) : wall;
+}
+
+// the buffer needs room for WALL_CLOCK_PREFIX_LEN + 1 bytes; only the first caller
+// within a second pays for localtime_r and strftime, the rest get a copy
+size_t wall_clock_prefix(const time_t seconds, char * const buffer) {
+    mtx_lock(&cache.mtx);
+    if (seconds != cache.seconds) {
+        struct tm local;
+        if (!localtime_r(&seconds, &local))
+            fatal("localtime_r");
+        cache.length  = strftime(cache.prefix, sizeof(cache.prefix), "[%Y-%m-%d %H:%M:%S]", &local);
+        cache.seconds = seconds;
+    }
+    memcpy(buffer, cache.prefix, cache.length + 1);
+    const size_t length = cache.length;
+    mtx_unlock(&cache.mtx);
+    return length;
+}
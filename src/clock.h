@@ -0,0 +1,16 @@
+#pragma once
+
+// Where the timestamps come from: the monotonic clock for samples, deadlines and intervals, the wall
+// clock only for what people read. The wall clock is formatted once per second and shared by everyone.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define WALL_CLOCK_PREFIX_LEN 21 // "[YYYY-mm-dd HH:MM:SS]"
+
+uint64_t monotonic_nanos();
+int64_t monotonic_millis();
+uint64_t realtime_nanos();
+uint64_t realtime_of(const uint64_t monotonic);
+size_t wall_clock_prefix(const time_t seconds, char * const buffer);
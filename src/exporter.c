@@ -0,0 +1,424 @@
+#define _GNU_SOURCE // accept4
+
+#include "exporter.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "clock.h"
+#include "stats.h"
+#include "net.h"
+#include "pthread_util.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LISTEN_BACKLOG   16
+#define MAX_CONNECTIONS  64
+#define MAX_EVENTS       16
+#define REQUEST_BUF_LEN  1024
+#define HEADER_RESERVE   128
+#define METRIC_LINE_LEN  96    // a first guess at the body's size, it grows if that falls short
+#define CONNECTION_DEADLINE_MILLIS 10000 // for a scrape from accept to the last byte, idle or not
+#define HTTP_HEADER      "HTTP/1.0 200 OK\r\n" \
+                         "Content-Type: text/plain; version=0.0.4\r\n" \
+                         "Connection: close\r\n" \
+                         "Content-Length: %zu\r\n\r\n"
+
+// a fully rendered http response, shared by every scrape that started while it was current
+typedef struct {
+    atomic_uint refs;
+    size_t length;
+    char data[];
+} Response;
+
+typedef struct {
+    int fd;
+    size_t slot;
+    Response* response; // NULL until the request has been read
+    size_t written;
+    int64_t deadline;   // monotonic millis, past which the connection is dropped
+    char tail[4];       // the last bytes of the request, to spot its end across reads
+} Connection;
+
+// the body as it's rendered, grown whenever a line doesn't fit
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Body;
+
+struct Exporter {
+    int listen_fd;
+    int epoll_fd;
+    char* unix_path;
+    size_t num_connections;
+    Connection* connections[MAX_CONNECTIONS];
+    pthread_mutex_t mtx; // guards only the swap of the current response
+    Response* current;
+    int wakeup_fd;       // an eventfd, -1 if none
+};
+
+static Response* response_ref(Response * const response) {
+    atomic_fetch_add_explicit(&response->refs, 1, memory_order_relaxed);
+    return response;
+}
+
+static void response_unref(Response * const response) {
+    if (atomic_fetch_sub_explicit(&response->refs, 1, memory_order_acq_rel) == 1)
+        free(response);
+}
+
+// snprintf at the end of the body, which grows and takes the line again if it didn't fit
+static void append(Body * const body, const char * const format, ...) {
+    while (true) {
+        va_list args;
+        va_start(args, format);
+        const int nprinted = vsnprintf(body->data + body->len, body->capacity - body->len, format, args);
+        va_end(args);
+        if (nprinted < 0)
+            fatal("vsnprintf");
+        if ((size_t)nprinted < body->capacity - body->len) {
+            body->len += nprinted;
+            return;
+        }
+        body->capacity = MAX(2 * body->capacity, body->len + nprinted + 1);
+        body->data     = checked_realloc(body->data, body->capacity);
+    }
+}
+
+static void append_value(Body * const body, const cpu_usage_t value) {
+    if (value == UNKNOWN_USAGE)
+        append(body, " NaN\n");
+    else
+        append(body, " %.2f\n", value);
+}
+
+static void render_body(Body * const body, const CpuUsage * const usage) {
+    if (usage) {
+        append(body,
+            "# HELP cut_cpu_usage_percent CPU usage over the last sampling window.\n"
+            "# TYPE cut_cpu_usage_percent gauge\n");
+        for (long cpu = 0; cpu < usage->length; ++cpu) {
+            if (cpu == 0)
+                append(body, "cut_cpu_usage_percent{cpu=\"total\"}");
+            else
+                append(body, "cut_cpu_usage_percent{cpu=\"%ld\"}", cpu - 1);
+            append_value(body, usage->usage[cpu]);
+        }
+        if (usage->self) {
+            append(body,
+                "# HELP cut_self_usage_percent The tracker's own share of the CPU over the last sampling window.\n"
+                "# TYPE cut_self_usage_percent gauge\n");
+            for (long cpu = 0; cpu < usage->length; ++cpu) {
+                if (cpu == 0)
+                    append(body, "cut_self_usage_percent{cpu=\"total\"}");
+                else
+                    append(body, "cut_self_usage_percent{cpu=\"%ld\"}", cpu - 1);
+                append_value(body, usage->self[cpu]);
+            }
+        }
+        if (usage->topology) {
+            append(body,
+                "# HELP cut_group_usage_percent CPU usage averaged over a topology group.\n"
+                "# TYPE cut_group_usage_percent gauge\n");
+            for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+                for (long group = 0; group < usage->num_groups[level]; ++group) {
+                    append(body, "cut_group_usage_percent{level=\"%s\",id=\"%d\"}",
+                        topo_level_names[level], usage->topology->group_id[level][group]);
+                    append_value(body, usage->group_usage[level][group]);
+                }
+            }
+        }
+    }
+    if (usage) {
+        const SchedUsage* sched = &usage->sched;
+        append(body,
+            "# HELP cut_sampling_window_seconds How long the last sampling window was.\n"
+            "# TYPE cut_sampling_window_seconds gauge\ncut_sampling_window_seconds %.3f\n",
+            (usage->window_end_nanos - usage->window_start_nanos) / 1e9);
+        append(body,
+            "# HELP cut_procs_running Runnable tasks, averaged over the last sampling window.\n"
+            "# TYPE cut_procs_running gauge\ncut_procs_running");
+        append_value(body, sched->procs_running);
+        append(body,
+            "# HELP cut_procs_blocked Tasks blocked on io, averaged over the last sampling window.\n"
+            "# TYPE cut_procs_blocked gauge\ncut_procs_blocked");
+        append_value(body, sched->procs_blocked);
+        append(body,
+            "# HELP cut_context_switches_per_second Context switches over the last sampling window.\n"
+            "# TYPE cut_context_switches_per_second gauge\ncut_context_switches_per_second");
+        append_value(body, sched->ctxt_per_sec);
+        if (sched->psi) {
+            append(body,
+                "# HELP cut_cpu_pressure_percent Share of time tasks waited for a CPU (the window's own, or the kernel's averages).\n"
+                "# TYPE cut_cpu_pressure_percent gauge\n"
+                "cut_cpu_pressure_percent{kind=\"some\",window=\"sample\"}");
+            append_value(body, sched->some_stall);
+            append(body, "cut_cpu_pressure_percent{kind=\"some\",window=\"avg10\"}");
+            append_value(body, sched->some_avg10);
+            append(body, "cut_cpu_pressure_percent{kind=\"some\",window=\"avg60\"}");
+            append_value(body, sched->some_avg60);
+            append(body, "cut_cpu_pressure_percent{kind=\"full\",window=\"sample\"}");
+            append_value(body, sched->full_stall);
+            append(body, "cut_cpu_pressure_percent{kind=\"full\",window=\"avg10\"}");
+            append_value(body, sched->full_avg10);
+            append(body, "cut_cpu_pressure_percent{kind=\"full\",window=\"avg60\"}");
+            append_value(body, sched->full_avg60);
+        }
+    }
+    for (size_t id = 0; id < NUM_STATS; ++id)
+        append(body, "# HELP %s %s.\n# TYPE %s counter\n%s %llu\n",
+            stat_info[id].name, stat_info[id].help, stat_info[id].name, stat_info[id].name,
+            (unsigned long long)stat_get(id));
+}
+
+static size_t body_len_guess(const CpuUsage * const usage) {
+    size_t nlines = 3 * NUM_STATS + 6;
+    if (usage) {
+        nlines += usage->self ? 2 * usage->length : usage->length;
+        nlines += 20; // the window, the run queue and the pressure
+        for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+            nlines += usage->num_groups[level];
+    }
+    return nlines * METRIC_LINE_LEN;
+}
+
+// the headers go in front of the body, so that a scrape is a single write
+static Response* render_response(const CpuUsage * const usage) {
+    Body body = {.len = 0, .capacity = body_len_guess(usage)};
+    body.data = checked_malloc(body.capacity);
+    render_body(&body, usage);
+
+    Response* response = checked_malloc(sizeof(Response) + HEADER_RESERVE + body.len);
+    atomic_init(&response->refs, 1);
+    response->length  = checked_snprintf(response->data, HEADER_RESERVE, HTTP_HEADER, body.len);
+    memcpy(response->data + response->length, body.data, body.len);
+    response->length += body.len;
+    free(body.data);
+    return response;
+}
+
+static int listen_tcp(const char * const port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        fatal("socket");
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local agents only
+    addr.sin_port        = htons(strtol(port, NULL, 10)); // range-checked along with the other options
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        vfatal("bind 127.0.0.1:%s", port);
+    return fd;
+}
+
+Exporter* new_exporter(const char * const addr) {
+    Exporter* exporter = checked_malloc(sizeof(*exporter));
+    exporter->unix_path = NULL;
+    const char* path = unix_socket_path(addr);
+    if (path) {
+        exporter->unix_path = strdup(path);
+        exporter->listen_fd = listen_unix(exporter->unix_path);
+    } else {
+        exporter->listen_fd = listen_tcp(addr);
+    }
+    if (listen(exporter->listen_fd, LISTEN_BACKLOG) < 0)
+        fatal("listen");
+
+    if ((exporter->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        fatal("epoll_create1");
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL}; // NULL marks the listening socket
+    if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, exporter->listen_fd, &ev) < 0)
+        fatal("epoll_ctl");
+
+    exporter->num_connections = 0;
+    for (size_t slot = 0; slot < MAX_CONNECTIONS; ++slot)
+        exporter->connections[slot] = NULL;
+    exporter->wakeup_fd = -1;
+    mtx_init(&exporter->mtx);
+    exporter->current = render_response(NULL); // health counters only, until the first tick
+    return exporter;
+}
+
+void exporter_update(Exporter * const exporter, const CpuUsage * const usage) {
+    Response* response = render_response(usage);
+    mtx_lock(&exporter->mtx);
+    Response* old = exporter->current;
+    exporter->current = response;
+    mtx_unlock(&exporter->mtx);
+    response_unref(old); // scrapes in flight keep their own reference
+}
+
+static void close_connection(Exporter * const exporter, Connection * const conn) {
+    epoll_ctl(exporter->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->response)
+        response_unref(conn->response);
+    exporter->connections[conn->slot] = NULL;
+    free(conn);
+    exporter->num_connections--;
+}
+
+static void accept_connections(Exporter * const exporter) {
+    int fd;
+    while ((fd = accept4(exporter->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (exporter->num_connections == MAX_CONNECTIONS) {
+            close(fd);
+            continue;
+        }
+        Connection* conn = checked_malloc(sizeof(*conn));
+        conn->slot = 0;
+        while (exporter->connections[conn->slot])
+            conn->slot++;
+        exporter->connections[conn->slot] = conn;
+        conn->fd       = fd;
+        conn->response = NULL;
+        conn->written  = 0;
+        conn->deadline = monotonic_millis() + CONNECTION_DEADLINE_MILLIS;
+        memset(conn->tail, 0, sizeof(conn->tail));
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            fatal("epoll_ctl");
+        exporter->num_connections++;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+        fatal("accept4");
+}
+
+// true once the blank line ending the request headers has been seen
+static bool read_request(Connection * const conn, bool * const failed) {
+    char buffer[REQUEST_BUF_LEN];
+    ssize_t nread;
+    while ((nread = read(conn->fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < nread; ++i) {
+            memmove(conn->tail, conn->tail + 1, sizeof(conn->tail) - 1);
+            conn->tail[sizeof(conn->tail) - 1] = buffer[i];
+            if (memcmp(conn->tail, "\r\n\r\n", sizeof(conn->tail)) == 0)
+                return true;
+        }
+    }
+    *failed = nread == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    return false;
+}
+
+// true when the connection is done with, one way or another
+static bool write_response(Connection * const conn) {
+    while (conn->written < conn->response->length) {
+        // a scraper hanging up halfway must not take the tracker down with a SIGPIPE
+        ssize_t nwritten = send(conn->fd, conn->response->data + conn->written, conn->response->length - conn->written,
+            MSG_NOSIGNAL);
+        if (nwritten < 0)
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        conn->written += nwritten;
+    }
+    stat_inc(STAT_SCRAPES_SERVED);
+    return true;
+}
+
+static void handle_connection(Exporter * const exporter, Connection * const conn) {
+    if (!conn->response) {
+        bool failed = false;
+        if (!read_request(conn, &failed)) {
+            if (failed)
+                close_connection(exporter, conn);
+            return;
+        }
+        mtx_lock(&exporter->mtx);
+        conn->response = response_ref(exporter->current);
+        mtx_unlock(&exporter->mtx);
+    }
+
+    if (write_response(conn)) {
+        close_connection(exporter, conn);
+        return;
+    }
+    // a slow scraper, carry on once its socket drains
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = conn};
+    if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+        fatal("epoll_ctl");
+}
+
+// the exporter's own epoll fd - it becomes readable when there's something to handle,
+// so an outer event loop can nest it and call exporter_poll with no timeout
+int exporter_fd(const Exporter * const exporter) {
+    return exporter->epoll_fd;
+}
+
+// lets whoever drives the loop get woken up for its own work, e.g. when there's a new usage to render
+void exporter_add_wakeup_fd(Exporter * const exporter, const int fd) {
+    exporter->wakeup_fd = fd;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &exporter->wakeup_fd};
+    if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        fatal("epoll_ctl");
+}
+
+// a client that connects and then sits there must not keep a slot from the scrapers for good
+void exporter_close_expired(Exporter * const exporter) {
+    const int64_t now = monotonic_millis();
+    for (size_t slot = 0; slot < MAX_CONNECTIONS; ++slot)
+        if (exporter->connections[slot] && exporter->connections[slot]->deadline <= now) {
+            close_connection(exporter, exporter->connections[slot]);
+            stat_inc(STAT_SCRAPES_EXPIRED);
+        }
+}
+
+// how long the poll may wait before the next connection is due to expire, -1 for as long as it takes
+static int expiry_timeout(const Exporter * const exporter, const int timeout_millis) {
+    int64_t earliest = -1;
+    for (size_t slot = 0; slot < MAX_CONNECTIONS; ++slot)
+        if (exporter->connections[slot] && (earliest < 0 || exporter->connections[slot]->deadline < earliest))
+            earliest = exporter->connections[slot]->deadline;
+    if (earliest < 0)
+        return timeout_millis;
+    const int until = MAX(earliest - monotonic_millis(), 0);
+    return timeout_millis < 0 ? until : MIN(timeout_millis, until);
+}
+
+// true if the wakeup fd fired
+bool exporter_poll(Exporter * const exporter, const int timeout_millis) {
+    struct epoll_event events[MAX_EVENTS];
+    int nready = epoll_wait(exporter->epoll_fd, events, MAX_EVENTS, expiry_timeout(exporter, timeout_millis));
+    if (nready < 0 && errno != EINTR)
+        fatal("epoll_wait");
+    bool woken = false;
+    for (int i = 0; i < nready; ++i) {
+        if (events[i].data.ptr == NULL)
+            accept_connections(exporter);
+        else if (events[i].data.ptr == &exporter->wakeup_fd) {
+            uint64_t count;
+            if (read(exporter->wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                fatal("read");
+            woken = true;
+        } else
+            handle_connection(exporter, events[i].data.ptr);
+    }
+    exporter_close_expired(exporter);
+    return woken;
+}
+
+void destroy_exporter(Exporter * const exporter) {
+    // the connections still open are just dropped - their scrapers will retry
+    for (size_t slot = 0; slot < MAX_CONNECTIONS; ++slot)
+        if (exporter->connections[slot])
+            close_connection(exporter, exporter->connections[slot]);
+    close(exporter->epoll_fd);
+    close(exporter->listen_fd);
+    if (exporter->unix_path) {
+        unlink(exporter->unix_path);
+        free(exporter->unix_path);
+    }
+    response_unref(exporter->current);
+    mtx_destroy(&exporter->mtx);
+    free(exporter);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Serves the latest usage and the tracker's health counters in prometheus exposition format,
+// over a unix socket ("unix:PATH") or localhost tcp ("PORT").
+
+#include "analyzer.h"
+
+#define EXPORTER_DEFAULT_ADDR "9462"
+
+typedef struct Exporter Exporter;
+
+Exporter* new_exporter(const char * const addr);
+void exporter_update(Exporter * const exporter, const CpuUsage * const usage);
+int exporter_fd(const Exporter * const exporter);
+void exporter_add_wakeup_fd(Exporter * const exporter, const int fd);
+bool exporter_poll(Exporter * const exporter, const int timeout_millis);
+void exporter_close_expired(Exporter * const exporter); // exporter_poll does this too
+void destroy_exporter(Exporter * const exporter);
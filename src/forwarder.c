@@ -0,0 +1,156 @@
+#include "forwarder.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "clock.h"
+#include "frame.h"
+#include "stats.h"
+#include "net.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define DEFAULT_HOST      "localhost"
+#define RECONNECT_MILLIS  1000
+
+struct Forwarder {
+    struct sockaddr_storage addr; // resolved once, a tracker shouldn't be stuck in dns every reconnect
+    socklen_t addr_len;
+    char host[FRAME_MAX_HOST_LEN + 1];
+    int fd;                  // -1 while disconnected
+    bool connecting;         // a non-blocking connect is in progress
+    int64_t retry_at_millis;
+    uint64_t seq;
+    uint8_t frame[FRAME_MAX_LEN];
+    size_t frame_len;
+    size_t frame_pos;        // how much of the frame is out, a partly sent frame has to be finished first
+};
+
+static void resolve_unix(Forwarder * const forwarder, const char * const path) {
+    unix_socket_addr(path, (struct sockaddr_un*)&forwarder->addr);
+    forwarder->addr_len = sizeof(struct sockaddr_un);
+}
+
+// "HOST:PORT", "[IPV6]:PORT", or just "PORT" on this host
+static void resolve_tcp(Forwarder * const forwarder, const char * const addr) {
+    char host[256];
+    const char* port = split_host_port(addr, host, sizeof(host));
+    if (!host[0])
+        checked_snprintf(host, sizeof(host), "%s", DEFAULT_HOST);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result;
+    int res = getaddrinfo(host, port, &hints, &result);
+    if (res != 0) {
+        errno = 0; // not a system error
+        vfatal("failed to resolve %s: %s", addr, gai_strerror(res));
+    }
+    memcpy(&forwarder->addr, result->ai_addr, result->ai_addrlen);
+    forwarder->addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+}
+
+Forwarder* new_forwarder(const char * const addr, const char * const host) {
+    Forwarder* forwarder = checked_malloc(sizeof(*forwarder));
+    const char* path = unix_socket_path(addr);
+    if (path)
+        resolve_unix(forwarder, path);
+    else
+        resolve_tcp(forwarder, addr);
+    checked_snprintf(forwarder->host, sizeof(forwarder->host), "%s", host);
+    forwarder->fd              = -1;
+    forwarder->connecting      = false;
+    forwarder->retry_at_millis = 0;
+    forwarder->seq             = 0;
+    forwarder->frame_len       = 0;
+    forwarder->frame_pos       = 0;
+    return forwarder;
+}
+
+static void disconnect(Forwarder * const forwarder, const int64_t now_millis) {
+    close(forwarder->fd);
+    forwarder->fd              = -1;
+    forwarder->connecting      = false;
+    forwarder->retry_at_millis = now_millis + RECONNECT_MILLIS;
+    forwarder->frame_len       = 0; // a new connection starts on a frame boundary
+    forwarder->frame_pos       = 0;
+}
+
+// true once there's a connection to send on - the connect itself never blocks
+static bool ensure_connected(Forwarder * const forwarder, const int64_t now_millis) {
+    if (forwarder->fd < 0) {
+        if (now_millis < forwarder->retry_at_millis)
+            return false;
+        forwarder->fd = socket(forwarder->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (forwarder->fd < 0)
+            fatal("socket");
+        if (connect(forwarder->fd, (struct sockaddr*)&forwarder->addr, forwarder->addr_len) == 0)
+            return true;
+        if (errno != EINPROGRESS) {
+            disconnect(forwarder, now_millis);
+            return false;
+        }
+        forwarder->connecting = true;
+    }
+    if (forwarder->connecting) {
+        struct pollfd pfd = {.fd = forwarder->fd, .events = POLLOUT};
+        if (poll(&pfd, 1, 0) <= 0)
+            return false;
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (getsockopt(forwarder->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0) {
+            disconnect(forwarder, now_millis);
+            return false;
+        }
+        forwarder->connecting = false;
+    }
+    return true;
+}
+
+// true once the whole frame is out
+static bool send_frame(Forwarder * const forwarder, const int64_t now_millis) {
+    while (forwarder->frame_pos < forwarder->frame_len) {
+        ssize_t nsent = send(forwarder->fd, forwarder->frame + forwarder->frame_pos, forwarder->frame_len - forwarder->frame_pos,
+            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nsent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                disconnect(forwarder, now_millis);
+            return false;
+        }
+        forwarder->frame_pos += nsent;
+    }
+    return true;
+}
+
+// the sequence moves on for every snapshot, so that the aggregator can tell how many it missed
+void forward_usage(Forwarder * const forwarder, const CpuUsage * const usage) {
+    const int64_t now_millis = monotonic_millis();
+    const uint64_t seq = forwarder->seq++;
+    if (!ensure_connected(forwarder, now_millis) || !send_frame(forwarder, now_millis)) {
+        stat_inc(STAT_FRAMES_DROPPED); // still busy with the previous one, or nowhere to send to
+        return;
+    }
+    forwarder->frame_len = encode_frame(forwarder->frame, forwarder->host, seq, realtime_of(usage->window_end_nanos),
+        usage->usage, usage->length);
+    forwarder->frame_pos = 0;
+    // whatever doesn't go out now goes out before the next frame, unless the connection is gone
+    if (!send_frame(forwarder, now_millis) && forwarder->fd < 0)
+        stat_inc(STAT_FRAMES_DROPPED);
+    else
+        stat_inc(STAT_FRAMES_FORWARDED);
+}
+
+void destroy_forwarder(Forwarder * const forwarder) {
+    if (forwarder->fd >= 0)
+        close(forwarder->fd);
+    free(forwarder);
+}
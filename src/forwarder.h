@@ -0,0 +1,13 @@
+#pragma once
+
+// Streams every usage snapshot as a binary frame to an aggregator, over a unix socket ("unix:PATH")
+// or tcp ("HOST:PORT"). It never blocks the tracker: a frame that doesn't fit into the socket is
+// dropped, and a lost aggregator is reconnected to in the background of the next frames.
+
+#include "analyzer.h"
+
+typedef struct Forwarder Forwarder;
+
+Forwarder* new_forwarder(const char * const addr, const char * const host);
+void forward_usage(Forwarder * const forwarder, const CpuUsage * const usage);
+void destroy_forwarder(Forwarder * const forwarder);
@@ -0,0 +1,78 @@
+#include "frame.h"
+
+#include "util.h"
+
+#include <string.h>
+
+// the header: length of the whole frame, magic, version, host length, number of values, sequence, timestamp
+#define OFF_LENGTH     0
+#define OFF_MAGIC      4
+#define OFF_VERSION    8
+#define OFF_HOST_LEN   10
+#define OFF_NUM_VALUES 12
+#define OFF_SEQ        16
+#define OFF_TIMESTAMP  24
+#define UNKNOWN_VALUE  0xffff
+
+static void put_be(uint8_t * const buffer, const uint64_t value, const size_t nbytes) {
+    for (size_t i = 0; i < nbytes; ++i)
+        buffer[i] = value >> (8 * (nbytes - 1 - i));
+}
+
+static uint64_t get_be(const uint8_t * const buffer, const size_t nbytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < nbytes; ++i)
+        value = value << 8 | buffer[i];
+    return value;
+}
+
+// the buffer needs room for FRAME_MAX_LEN bytes, whatever doesn't fit into a frame is cut off
+size_t encode_frame(uint8_t * const buffer, const char * const host, const uint64_t seq, const uint64_t timestamp_nanos,
+    const float * const values, const uint32_t num_values) {
+    const size_t host_len = MIN(strlen(host), FRAME_MAX_HOST_LEN);
+    const uint32_t count  = MIN(num_values, FRAME_MAX_VALUES);
+    const size_t length   = FRAME_HEADER_LEN + host_len + 2 * count;
+
+    put_be(buffer + OFF_LENGTH, length, 4);
+    put_be(buffer + OFF_MAGIC, FRAME_MAGIC, 4);
+    put_be(buffer + OFF_VERSION, FRAME_VERSION, 2);
+    put_be(buffer + OFF_HOST_LEN, host_len, 2);
+    put_be(buffer + OFF_NUM_VALUES, count, 4);
+    put_be(buffer + OFF_SEQ, seq, 8);
+    put_be(buffer + OFF_TIMESTAMP, timestamp_nanos, 8);
+    memcpy(buffer + FRAME_HEADER_LEN, host, host_len);
+    uint8_t* value = buffer + FRAME_HEADER_LEN + host_len;
+    for (uint32_t i = 0; i < count; ++i, value += 2)
+        put_be(value, values[i] < 0 ? UNKNOWN_VALUE : (uint16_t)(MIN(values[i], 100.0f) * 100 + 0.5f), 2);
+    return length;
+}
+
+// the length of the frame at the start of the buffer, FRAME_INCOMPLETE until all of it has arrived,
+// or FRAME_INVALID if the stream is garbage and had better be dropped
+long decode_frame(const uint8_t * const buffer, const size_t len, Frame * const frame) {
+    if (len < FRAME_HEADER_LEN)
+        return FRAME_INCOMPLETE;
+    const size_t length     = get_be(buffer + OFF_LENGTH, 4);
+    const size_t host_len   = get_be(buffer + OFF_HOST_LEN, 2);
+    const uint32_t count    = get_be(buffer + OFF_NUM_VALUES, 4);
+    if (get_be(buffer + OFF_MAGIC, 4) != FRAME_MAGIC || get_be(buffer + OFF_VERSION, 2) != FRAME_VERSION
+        || host_len > FRAME_MAX_HOST_LEN || count > FRAME_MAX_VALUES || length != FRAME_HEADER_LEN + host_len + 2 * count)
+        return FRAME_INVALID;
+    if (len < length)
+        return FRAME_INCOMPLETE;
+
+    memcpy(frame->host, buffer + FRAME_HEADER_LEN, host_len);
+    frame->host[host_len]  = '\0';
+    for (size_t i = 0; i < host_len; ++i) // it's printed to terminals, and has to be a string in one piece
+        if ((unsigned char)frame->host[i] < 0x20 || (unsigned char)frame->host[i] > 0x7e)
+            frame->host[i] = '?';
+    frame->seq             = get_be(buffer + OFF_SEQ, 8);
+    frame->timestamp_nanos = get_be(buffer + OFF_TIMESTAMP, 8);
+    frame->num_values      = count;
+    const uint8_t* value   = buffer + FRAME_HEADER_LEN + host_len;
+    for (uint32_t i = 0; i < count; ++i, value += 2) {
+        uint16_t raw = get_be(value, 2);
+        frame->values[i] = raw == UNKNOWN_VALUE ? -1.0f : raw / 100.0f;
+    }
+    return length;
+}
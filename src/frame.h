@@ -0,0 +1,29 @@
+#pragma once
+
+// The compact binary frames a tracker forwards its usage to an aggregator in: a fixed header, the host's
+// name, then every cpu's usage (the total first) in hundredths of a percent. Everything is big-endian,
+// so that trackers and an aggregator on different machines agree.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_MAGIC        0x43555446u // "CUTF"
+#define FRAME_VERSION      1
+#define FRAME_HEADER_LEN   32
+#define FRAME_MAX_HOST_LEN 64
+#define FRAME_MAX_VALUES   1025        // the total and up to 1024 cpus
+#define FRAME_MAX_LEN      (FRAME_HEADER_LEN + FRAME_MAX_HOST_LEN + 2 * FRAME_MAX_VALUES)
+#define FRAME_INCOMPLETE   0
+#define FRAME_INVALID      (-1)
+
+typedef struct {
+    char host[FRAME_MAX_HOST_LEN + 1];
+    uint64_t seq;             // consecutive per sender, a gap means frames were dropped on the way
+    uint64_t timestamp_nanos; // the sender's wall clock
+    uint32_t num_values;
+    float values[FRAME_MAX_VALUES]; // negative if unknown
+} Frame;
+
+size_t encode_frame(uint8_t * const buffer, const char * const host, const uint64_t seq, const uint64_t timestamp_nanos,
+    const float * const values, const uint32_t num_values);
+long decode_frame(const uint8_t * const buffer, const size_t len, Frame * const frame);
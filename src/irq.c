@@ -0,0 +1,328 @@
+#include "irq.h"
+
+#include "mem.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define INITIAL_BUF_LEN 16384 // doubled while a table doesn't fit
+#define NUM_TABLES      2
+#define NOT_PER_CPU     (-1)  // a row with a single count, like ERR and MIS
+
+typedef struct {
+    char label[IRQ_NAME_LEN];  // what the line starts with, e.g. "24" or "LOC" or "NET_RX"
+    size_t label_len;          // in full, the label may have been cut off
+    long source;               // among the table's sources, or NOT_PER_CPU
+    char name[IRQ_NAME_LEN];
+} Row;
+
+typedef struct {
+    int fd;                    // kept open, every read starts over at offset 0
+    char* buffer;
+    size_t capacity;
+    size_t len;
+    // the cached layout, only valid while the file still starts with the same header and rows
+    bool valid;
+    char* header;
+    size_t header_len;
+    long num_columns;
+    long* cpu_of_column;
+    size_t* column_offset;     // where a column's counts go in a snapshot, for the table's first source
+    Row* rows;
+    size_t num_rows;
+    size_t num_sources;
+} Table;
+
+struct IrqReader {
+    Table tables[NUM_TABLES];
+    long num_cpus;
+    IrqLayout* layout;         // NULL until the tables were read once
+};
+
+static void table_init(Table * const table, const char * const path) {
+    memset(table, 0, sizeof(*table));
+    table->fd       = open(path, O_RDONLY | O_CLOEXEC); // a kernel without the file just has no such source
+    table->capacity = INITIAL_BUF_LEN;
+    table->buffer   = checked_malloc(table->capacity);
+}
+
+IrqReader* new_irq_reader(const char * const interrupts_path, const char * const softirqs_path, const long num_cpus) {
+    IrqReader* reader = checked_malloc(sizeof(*reader));
+    table_init(reader->tables + 0, interrupts_path);
+    table_init(reader->tables + 1, softirqs_path);
+    reader->num_cpus = num_cpus;
+    reader->layout   = NULL;
+    return reader; // don't forget to free!
+}
+
+// the whole file in as few reads as it takes, terminated so that a line can be scanned to its end
+static bool read_table(Table * const table) {
+    if (table->fd < 0)
+        return false;
+    table->len = 0;
+    for (;;) {
+        if (table->len + 1 >= table->capacity) {
+            char* buffer = checked_malloc(2 * table->capacity);
+            memcpy(buffer, table->buffer, table->len);
+            free(table->buffer);
+            table->buffer    = buffer;
+            table->capacity *= 2;
+        }
+        ssize_t nread = pread(table->fd, table->buffer + table->len, table->capacity - 1 - table->len, table->len);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread < 0)
+            return false;
+        if (nread == 0)
+            break;
+        table->len += nread;
+    }
+    table->buffer[table->len] = '\0';
+    return table->len > 0;
+}
+
+static inline const char* skip_spaces(const char* p, const char * const end) {
+    while (p < end && *p == ' ')
+        ++p;
+    return p;
+}
+
+// no locale, no sign and no overflow checks - the kernel prints every count as a plain %10u
+static inline const char* scan_u32(const char* p, const char * const end, uint32_t * const value) {
+    p = skip_spaces(p, end);
+    if (p == end || (unsigned)(*p - '0') > 9)
+        return NULL;
+    uint32_t v = 0;
+    do
+        v = v * 10 + (uint32_t)(*p++ - '0');
+    while (p < end && (unsigned)(*p - '0') <= 9);
+    *value = v;
+    return p;
+}
+
+static inline const char* line_end(const char * const p, const char * const end) {
+    const char* eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+static inline bool same_label(const Row * const row, const char * const label, const size_t len) {
+    return len == row->label_len && memcmp(row->label, label, MIN(len, sizeof(row->label) - 1)) == 0;
+}
+
+// the counts of every row the layout knows, straight into their cpus' slots; false as soon as the
+// file turns out to have changed, e.g. a driver registered a new interrupt or a cpu went offline
+static bool scan_table(const Table * const table, uint32_t * const counts) {
+    const char* p   = table->buffer;
+    const char* end = table->buffer + table->len;
+    const char* eol = line_end(p, end);
+    if ((size_t)(eol - p) != table->header_len || memcmp(p, table->header, table->header_len) != 0)
+        return false;
+    for (size_t i = 0; i < table->num_rows; ++i) {
+        p = eol + 1;
+        if (p >= end)
+            return false;
+        eol = line_end(p, end);
+        const char* label = skip_spaces(p, eol);
+        const char* colon = memchr(label, ':', eol - label);
+        const Row* row    = table->rows + i;
+        if (!colon || !same_label(row, label, colon - label))
+            return false;
+        if (row->source == NOT_PER_CPU)
+            continue;
+        const char* q = colon + 1;
+        for (long column = 0; column < table->num_columns; ++column)
+            if (!(q = scan_u32(q, eol, counts + table->column_offset[column] + row->source)))
+                return false;
+    }
+    return eol + 1 >= end; // and no rows past the known ones
+}
+
+static void sanitize(char * const name) {
+    for (char* c = name; *c; ++c)
+        if (!isalnum((unsigned char)*c) && !strchr("_.:-/", *c))
+            *c = '_'; // the names go into json and onto the screen as they are
+}
+
+// numbered interrupt lines go by their number and their device, the others by their label alone
+static void name_row(Row * const row, const char * const label, const size_t label_len, const char * const eol) {
+    bool numbered = label_len > 0;
+    for (size_t i = 0; i < label_len; ++i)
+        numbered &= isdigit((unsigned char)label[i]) != 0;
+    const char* device = eol;
+    while (device > label + label_len && device[-1] == ' ')
+        --device;
+    const char* device_end = device;
+    while (device > label + label_len && device[-1] != ' ')
+        --device;
+    if (numbered && device_end > device)
+        checked_snprintf(row->name, sizeof(row->name), "%.*s:%.*s", (int)label_len, label, (int)(device_end - device), device);
+    else
+        checked_snprintf(row->name, sizeof(row->name), "%.*s", (int)label_len, label);
+    sanitize(row->name);
+}
+
+static void free_layout(Table * const table) {
+    free(table->header);
+    free(table->cpu_of_column);
+    free(table->column_offset);
+    free(table->rows);
+    table->header        = NULL;
+    table->cpu_of_column = NULL;
+    table->column_offset = NULL;
+    table->rows          = NULL;
+    table->valid         = false;
+}
+
+// "           CPU0       CPU1       CPU3" - offline cpus have no column
+static bool parse_header(Table * const table, const char * const p, const char * const eol, const long num_cpus) {
+    table->num_columns = 0;
+    for (const char* c = p; (c = memchr(c, 'C', eol - c)); ++c)
+        table->num_columns++;
+    table->cpu_of_column = checked_malloc(MAX(table->num_columns, 1) * sizeof(long));
+    table->column_offset = checked_malloc(MAX(table->num_columns, 1) * sizeof(size_t));
+    long column = 0;
+    for (const char* c = p; (c = memchr(c, 'C', eol - c)); ++c) {
+        char* end;
+        long cpu = strtol(c + strlen("CPU"), &end, 10);
+        if (strncmp(c, "CPU", strlen("CPU")) != 0 || end == c + strlen("CPU") || cpu < 0 || cpu >= num_cpus)
+            return false;
+        table->cpu_of_column[column++] = cpu;
+    }
+    table->header_len = eol - p;
+    table->header     = checked_malloc(table->header_len + 1);
+    memcpy(table->header, p, table->header_len);
+    return table->num_columns > 0;
+}
+
+// the slow path, only when a table is first read or has changed since
+static bool parse_layout(Table * const table, const long num_cpus) {
+    free_layout(table);
+    const char* p   = table->buffer;
+    const char* end = table->buffer + table->len;
+    const char* eol = line_end(p, end);
+    if (!parse_header(table, p, eol, num_cpus))
+        return false;
+
+    size_t max_rows = 1;
+    for (const char* c = p; (c = memchr(c, '\n', end - c)); ++c)
+        max_rows++;
+    table->rows        = checked_malloc(max_rows * sizeof(Row));
+    table->num_rows    = 0;
+    table->num_sources = 0;
+    for (p = eol + 1; p < end; p = eol + 1) {
+        eol = line_end(p, end);
+        const char* label = skip_spaces(p, eol);
+        const char* colon = memchr(label, ':', eol - label);
+        if (!colon)
+            return false;
+        Row* row = table->rows + table->num_rows++;
+        row->label_len = colon - label;
+        checked_snprintf(row->label, sizeof(row->label), "%.*s", (int)row->label_len, label);
+        uint32_t count;
+        long ncounts = 0;
+        for (const char* q = colon + 1; ncounts < table->num_columns && (q = scan_u32(q, eol, &count)); )
+            ++ncounts;
+        row->source = ncounts == table->num_columns ? (long)table->num_sources++ : NOT_PER_CPU;
+        name_row(row, label, row->label_len, eol);
+    }
+    return true;
+}
+
+static IrqLayout* new_layout(IrqReader * const reader) {
+    size_t num_sources = 0;
+    for (size_t i = 0; i < NUM_TABLES; ++i)
+        num_sources += reader->tables[i].valid ? reader->tables[i].num_sources : 0;
+    IrqLayout* layout = checked_malloc(sizeof(*layout));
+    atomic_init(&layout->refs, 1);
+    layout->num_sources = num_sources;
+    layout->names       = checked_malloc(MAX(num_sources, 1u) * IRQ_NAME_LEN);
+
+    size_t first_source = 0;
+    for (size_t i = 0; i < NUM_TABLES; ++i) {
+        Table* table = reader->tables + i;
+        if (!table->valid)
+            continue;
+        for (long column = 0; column < table->num_columns; ++column)
+            table->column_offset[column] = table->cpu_of_column[column] * num_sources + first_source;
+        for (size_t row = 0; row < table->num_rows; ++row)
+            if (table->rows[row].source != NOT_PER_CPU)
+                memcpy(layout->names[first_source + table->rows[row].source], table->rows[row].name, IRQ_NAME_LEN);
+        first_source += table->num_sources;
+    }
+    return layout;
+}
+
+static IrqSnapshot* new_snapshot(IrqReader * const reader) {
+    const size_t num_counts = reader->num_cpus * reader->layout->num_sources;
+    IrqSnapshot* snapshot = checked_malloc(sizeof(IrqSnapshot) + num_counts * sizeof(uint32_t));
+    snapshot->layout   = irq_layout_ref(reader->layout);
+    snapshot->num_cpus = reader->num_cpus;
+    memset(snapshot->counts, 0, num_counts * sizeof(uint32_t)); // the offline cpus' stay that way
+    return snapshot;
+}
+
+IrqSnapshot* irq_read(IrqReader * const reader) {
+    bool readable[NUM_TABLES];
+    bool any = false;
+    for (size_t i = 0; i < NUM_TABLES; ++i)
+        any |= readable[i] = read_table(reader->tables + i);
+    if (!any)
+        return NULL;
+
+    if (reader->layout) {
+        IrqSnapshot* snapshot = new_snapshot(reader);
+        bool unchanged = true;
+        for (size_t i = 0; unchanged && i < NUM_TABLES; ++i)
+            unchanged = readable[i] == reader->tables[i].valid && (!readable[i] || scan_table(reader->tables + i, snapshot->counts));
+        if (unchanged)
+            return snapshot;
+        free_irq_snapshot(snapshot);
+    }
+
+    for (size_t i = 0; i < NUM_TABLES; ++i)
+        reader->tables[i].valid = readable[i] && parse_layout(reader->tables + i, reader->num_cpus);
+    if (reader->layout)
+        irq_layout_unref(reader->layout);
+    reader->layout = new_layout(reader);
+    IrqSnapshot* snapshot = new_snapshot(reader);
+    for (size_t i = 0; i < NUM_TABLES; ++i)
+        if (reader->tables[i].valid)
+            scan_table(reader->tables + i, snapshot->counts); // the same buffer the layout came from, it can't fail
+    return snapshot;
+}
+
+void destroy_irq_reader(IrqReader * const reader) {
+    for (size_t i = 0; i < NUM_TABLES; ++i) {
+        Table* table = reader->tables + i;
+        if (table->fd >= 0)
+            close(table->fd);
+        free_layout(table);
+        free(table->buffer);
+    }
+    if (reader->layout)
+        irq_layout_unref(reader->layout);
+    free(reader);
+}
+
+void free_irq_snapshot(IrqSnapshot * const snapshot) {
+    irq_layout_unref(snapshot->layout);
+    free(snapshot);
+}
+
+IrqLayout* irq_layout_ref(IrqLayout * const layout) {
+    atomic_fetch_add_explicit(&layout->refs, 1, memory_order_relaxed);
+    return layout;
+}
+
+void irq_layout_unref(IrqLayout * const layout) {
+    if (atomic_fetch_sub_explicit(&layout->refs, 1, memory_order_acq_rel) == 1) {
+        free(layout->names);
+        free(layout);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Per-cpu counters of every interrupt line and softirq, from /proc/interrupts and /proc/softirqs.
+// Both tables have a column per online cpu, which makes them wide on big boxes - their layout (the
+// columns and which row is which source) is parsed once and only checked on every later read, which
+// then comes down to scanning integers.
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IRQ_NAME_LEN    32
+#define IRQ_TOP_SOURCES 3 // per cpu, in the analyzer's usage
+
+// the sources' names, shared by every snapshot and usage taken while the layout held
+typedef struct {
+    _Atomic unsigned refs;
+    size_t num_sources;          // the interrupt lines first, then the softirqs
+    char (*names)[IRQ_NAME_LEN];
+} IrqLayout;
+
+typedef struct {
+    IrqLayout* layout;           // a reference
+    long num_cpus;
+    uint32_t counts[];           // [cpu * num_sources + source], the kernel's own 32 bits that wrap around
+} IrqSnapshot;
+
+typedef struct {
+    uint32_t source;
+    float rate;                  // per second
+} IrqRate;
+
+typedef struct {
+    IrqLayout* layout;           // a reference, for the names
+    long num_cpus;
+    IrqRate* top;                // [cpu * IRQ_TOP_SOURCES + rank], the busiest first, rate 0 past the busy ones
+} IrqUsage;
+
+typedef struct IrqReader IrqReader;
+
+IrqReader* new_irq_reader(const char * const interrupts_path, const char * const softirqs_path, const long num_cpus);
+IrqSnapshot* irq_read(IrqReader * const reader); // NULL if neither table can be read
+void destroy_irq_reader(IrqReader * const reader);
+void free_irq_snapshot(IrqSnapshot * const snapshot);
+IrqLayout* irq_layout_ref(IrqLayout * const layout);
+void irq_layout_unref(IrqLayout * const layout);
@@ -3,6 +3,9 @@
 #include "err.h"
 #include "mem.h"
 #include "util.h"
+#include "clock.h"
+#include "stats.h"
+#include "pthread_util.h"
 
 #include <sys/stat.h>
 #include <stddef.h>
@@ -17,9 +20,14 @@
 #define LOGFILE_PREFIX "cut-"
 #define LOGFILE_SUFFIX ".log"
 #define LOGFILE_LEN    (sizeof(LOGS_DIR LOGFILE_PREFIX LOGFILE_SUFFIX) + TIMESTAMP_LEN - 1)
+#define REPEAT_MSG_LEN 64
+#define LOG_SITE_INTERVAL_MILLIS (1000 / LOG_SITE_RATE)
 
 struct {
     FILE* logfile;
+    pthread_mutex_t mtx; // guards the rest, messages may be printed from more than one thread
+    LogMsg* last;        // the last message printed, to fold its repeats into a count
+    uint64_t repeats;
 } logger; // a singleton instance
 
 typedef struct {
@@ -46,13 +54,11 @@ LogMsg* new_log_msg(const log_level_t level, const char * const file, const size
     length++;
 
     LogMsg* msg = checked_malloc(sizeof(LogMsg) + length * sizeof(char)); 
-    time_t now  = time(NULL);
-    msg->time   = localtime(&now);
-    if (!msg->time)
-        fatal("localtime");
-    msg->level = level;
-    msg->file  = file; // this has a static storage duration, no need for strdup
-    msg->line  = line;
+    msg->time       = time(NULL);
+    msg->level      = level;
+    msg->file       = file; // this has a static storage duration, no need for strdup
+    msg->line       = line;
+    msg->suppressed = 0;
 
     va_start(args, fmt);
     if (vsnprintf(msg->contents, length, fmt, args) < 0)
@@ -66,30 +72,99 @@ void free_log_msg(LogMsg* msg) {
     free(msg);
 }
 
-void print_log_msg(LogMsg* msg) {
-    char time_buf[TIMESTAMP_LEN + 1] = {'\0'};
-    strftime(time_buf, sizeof(time_buf), "[%Y-%m-%d %H:%M:%S]", msg->time);
+// admits a message as long as the bucket isn't empty, and hands over the count of those it turned away meanwhile
+bool log_site_admit(LogSite * const site, uint64_t * const suppressed) {
+    const int64_t now = monotonic_millis();
+    int64_t full_at = atomic_load_explicit(&site->full_at_millis, memory_order_relaxed);
+    int64_t next;
+    do {
+        if (full_at - now > (LOG_SITE_BURST - 1) * LOG_SITE_INTERVAL_MILLIS) {
+            atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+            stat_inc(STAT_LOGS_SUPPRESSED);
+            return false;
+        }
+        next = MAX(full_at, now) + LOG_SITE_INTERVAL_MILLIS;
+    } while (!atomic_compare_exchange_weak_explicit(&site->full_at_millis, &full_at, next, memory_order_relaxed, memory_order_relaxed));
+    *suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    return true;
+}
+
+static void write_msg(const LogMsg * const msg, const char * const contents, const uint64_t suppressed) {
+    char time_buf[WALL_CLOCK_PREFIX_LEN + 1];
+    wall_clock_prefix(msg->time, time_buf);
+    char suffix[REPEAT_MSG_LEN] = {'\0'};
+    if (suppressed)
+        checked_snprintf(suffix, sizeof(suffix), " (%llu similar messages suppressed)", (unsigned long long)suppressed);
     if (logger.logfile == stderr)
-        checked_fprintf(logger.logfile, "%s %s%-5s\x1b[0m \x1b[90m%s:%zu:\x1b[0m %s\n", 
-            time_buf, pretty[msg->level].color, pretty[msg->level].name, msg->file, msg->line, msg->contents);
+        checked_fprintf(logger.logfile, "%s %s%-5s\x1b[0m \x1b[90m%s:%zu:\x1b[0m %s%s\n", 
+            time_buf, pretty[msg->level].color, pretty[msg->level].name, msg->file, msg->line, contents, suffix);
     else
-        checked_fprintf(logger.logfile, "%s %-5s %s:%zu: %s\n", 
-            time_buf,                           pretty[msg->level].name, msg->file, msg->line, msg->contents);
+        checked_fprintf(logger.logfile, "%s %-5s %s:%zu: %s%s\n", 
+            time_buf,                           pretty[msg->level].name, msg->file, msg->line, contents, suffix);
     fflush(logger.logfile);
-    free_log_msg(msg);
+}
+
+static bool same_msg(const LogMsg * const a, const LogMsg * const b) {
+    return a->level == b->level && a->line == b->line && a->file == b->file && strcmp(a->contents, b->contents) == 0;
+}
+
+static void flush_repeats() {
+    if (!logger.repeats)
+        return;
+    char text[REPEAT_MSG_LEN];
+    checked_snprintf(text, sizeof(text), "last message repeated %llu times", (unsigned long long)logger.repeats);
+    write_msg(logger.last, text, 0);
+    logger.repeats = 0;
+}
+
+// identical consecutive messages are written once, followed by how many times they were repeated
+void print_log_msg(LogMsg* msg) {
+    mtx_lock(&logger.mtx);
+    if (logger.last && !msg->suppressed && same_msg(logger.last, msg)) {
+        logger.repeats++;
+        stat_inc(STAT_LOGS_COALESCED);
+        mtx_unlock(&logger.mtx);
+        free_log_msg(msg);
+        return;
+    }
+    flush_repeats();
+    write_msg(msg, msg->contents, msg->suppressed);
+    if (logger.last)
+        free_log_msg(logger.last);
+    logger.last = msg;
+    mtx_unlock(&logger.mtx);
+}
+
+bool log_repeats_pending() {
+    mtx_lock(&logger.mtx);
+    const bool pending = logger.repeats != 0;
+    mtx_unlock(&logger.mtx);
+    return pending;
+}
+
+// for when no different message is coming to push the count out
+void flush_log_repeats() {
+    mtx_lock(&logger.mtx);
+    flush_repeats();
+    mtx_unlock(&logger.mtx);
 }
 
 void logger_init(const bool log_to_file) {
+    mtx_init(&logger.mtx);
+    logger.last    = NULL;
+    logger.repeats = 0;
     if (!log_to_file)
         logger.logfile = stderr;
     else {
         struct stat st = {0};
         if (stat(LOGS_DIR, &st) < 0)
             mkdir(LOGS_DIR, 0777);
-        time_t now          = time(NULL);
-        struct tm* loc_time = localtime(&now);
+        time_t now = time(NULL);
+        struct tm loc_time;
+        if (!localtime_r(&now, &loc_time))
+            fatal("localtime_r");
         char filename[LOGFILE_LEN] = {'\0'};
-        strftime(filename, LOGFILE_LEN, LOGS_DIR LOGFILE_PREFIX "%Y-%m-%d-%H-%M-%S" LOGFILE_SUFFIX, loc_time);
+        strftime(filename, LOGFILE_LEN, LOGS_DIR LOGFILE_PREFIX "%Y-%m-%d-%H-%M-%S" LOGFILE_SUFFIX, &loc_time);
         if (!(logger.logfile = fopen(filename, "a")))
             fatal("fopen");
         else
@@ -98,6 +173,13 @@ void logger_init(const bool log_to_file) {
 }
 
 void logger_destroy() {
+    mtx_lock(&logger.mtx);
+    flush_repeats();
+    if (logger.last)
+        free_log_msg(logger.last);
+    logger.last = NULL;
+    mtx_unlock(&logger.mtx);
+    mtx_destroy(&logger.mtx);
     if (logger.logfile != stderr && fclose(logger.logfile) < 0)
         fatal("fclose");
 }
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOG_SITE_RATE  5  // messages per second a call site may log in the long run
+#define LOG_SITE_BURST 10 // and in a burst
+#define LOG_REPEAT_FLUSH_MILLIS 1000 // how long a "last message repeated" count may wait for a different message
 
 typedef enum { 
     LOG_TRACE, 
@@ -13,11 +20,12 @@ typedef enum {
 } log_level_t;
 
 typedef struct {
-    struct tm* time;
+    time_t time;         // only formatted by the logger, through the clock's shared per-second prefix
     log_level_t level;
     size_t line;
     const char* file;
     size_t length;
+    uint64_t suppressed; // how many of its call site's messages were dropped just before it
     char contents[]; // leaving this as a FAM guarantees one allocation. Pretty cool, right?
 } LogMsg;
 
@@ -34,8 +42,18 @@ do {                                                           \
     print_log_msg(msg);                                        \
 } while(0)
 
+// a call site's token bucket, kept as the time it will be full again (a generic cell rate algorithm),
+// so that admitting a message is a load and a compare-and-swap - zero-initialized as a static
+typedef struct {
+    _Atomic int64_t full_at_millis;
+    _Atomic uint64_t suppressed;
+} LogSite;
+
+bool log_site_admit(LogSite * const site, uint64_t * const suppressed);
 LogMsg* new_log_msg(const log_level_t level, const char * const file, const size_t line, const char * const fmt, ...);
 void free_log_msg(LogMsg* msg);
 void print_log_msg(LogMsg* msg);
+bool log_repeats_pending();
+void flush_log_repeats();
 void logger_init(const bool log_to_file);
 void logger_destroy();
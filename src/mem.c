@@ -3,6 +3,7 @@
 #include "err.h"
 
 #include <stdlib.h>
+#include <errno.h>
  
 void* checked_malloc(const size_t nbytes) {
     void* ptr = malloc(nbytes);
@@ -13,7 +14,17 @@ void* checked_malloc(const size_t nbytes) {
 
 void* checked_realloc(void* ptr, const size_t nbytes) {
     void* new_ptr = realloc(ptr, nbytes);
-    if (ptr == NULL)
+    if (new_ptr == NULL)
         fatal("realloc");
     return new_ptr;  // don't forget to free!
 }
+
+void* checked_aligned_malloc(const size_t alignment, const size_t nbytes) {
+    void* ptr = NULL;
+    int res = posix_memalign(&ptr, alignment, nbytes);
+    if (res != 0) {
+        errno = res;
+        fatal("posix_memalign");
+    }
+    return ptr;  // don't forget to free!
+}
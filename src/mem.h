@@ -1,4 +1,9 @@
+#pragma once
+
 #include <stdlib.h>
+
+#define CACHE_LINE 64
  
 void* checked_malloc(const size_t nbytes);
 void* checked_realloc(void* ptr, const size_t nbytes);
+void* checked_aligned_malloc(const size_t alignment, const size_t nbytes);
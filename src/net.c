@@ -0,0 +1,49 @@
+#include "net.h"
+
+#include "err.h"
+#include "util.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+const char* unix_socket_path(const char * const addr) {
+    return strncmp(addr, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0 ? addr + strlen(UNIX_PREFIX) : NULL;
+}
+
+void unix_socket_addr(const char * const path, struct sockaddr_un * const addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        vfatal("unix socket path too long: %s", path);
+    strcpy(addr->sun_path, path);
+}
+
+int listen_unix(const char * const path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        fatal("socket");
+    struct sockaddr_un addr;
+    unix_socket_addr(path, &addr);
+    unlink(path); // a stale socket from a previous run
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        vfatal("bind %s", path);
+    return fd;
+}
+
+// returns the port, with the host copied out - empty if there's none; an ipv6 address has to be
+// bracketed, as its own colons would get in the way
+const char* split_host_port(const char * const addr, char * const host, const size_t host_len) {
+    if (addr[0] == '[') {
+        const char* bracket = strchr(addr, ']');
+        if (!bracket || bracket[1] != ':') {
+            errno = 0; // not a system error
+            vfatal("expected [ADDRESS]:PORT, got %s", addr);
+        }
+        checked_snprintf(host, host_len, "%.*s", (int)(bracket - addr - 1), addr + 1);
+        return bracket + 2;
+    }
+    const char* sep = strrchr(addr, ':');
+    checked_snprintf(host, host_len, "%.*s", sep ? (int)(sep - addr) : 0, addr);
+    return sep ? sep + 1 : addr;
+}
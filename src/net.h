@@ -0,0 +1,16 @@
+#pragma once
+
+// Addresses as the options spell them - "unix:PATH" for a unix socket, otherwise "HOST:PORT",
+// "[IPV6]:PORT" or just "PORT" - shared by everything that listens or connects.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+
+#define UNIX_PREFIX "unix:"
+#define MAX_PORT    65535
+
+const char* unix_socket_path(const char * const addr); // NULL unless addr is "unix:PATH"
+void unix_socket_addr(const char * const path, struct sockaddr_un * const addr);
+int listen_unix(const char * const path);
+const char* split_host_port(const char * const addr, char * const host, const size_t host_len);
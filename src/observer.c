@@ -0,0 +1,100 @@
+#include "observer.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TASK_DIR            "/proc/self/task"
+#define TASK_STAT_PATH_LEN  64
+#define TASK_STAT_LEN       1024
+#define MAX_OBSERVED_TASKS  64
+
+typedef struct {
+    long tid;
+    cpu_time_t ticks; // user + system, as of the last sample
+} TaskTicks;
+
+static struct {
+    long num_cpus;
+    cpu_time_t* self_ticks; // cumulative, [0] for all of them and [cpu + 1] for every cpu
+    TaskTicks tasks[MAX_OBSERVED_TASKS];
+    size_t num_tasks;
+} observer; // a singleton instance
+
+// utime and stime are the 14th and 15th field, processor the 39th - all of them after the
+// parenthesized name, which may contain spaces and parentheses of its own
+static bool read_task(const long tid, cpu_time_t * const ticks, int * const cpu) {
+    char path[TASK_STAT_PATH_LEN];
+    char stat[TASK_STAT_LEN];
+    checked_snprintf(path, sizeof(path), TASK_DIR "/%ld/stat", tid);
+    if (!read_small_file(path, stat, sizeof(stat)))
+        return false; // the thread has just exited
+    const char* pos = strrchr(stat, ')');
+    if (!pos)
+        return false;
+    unsigned long long utime, stime;
+    if (sscanf(pos + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+                        "%*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+            &utime, &stime, cpu) != 3)
+        return false;
+    *ticks = utime + stime;
+    return true;
+}
+
+static cpu_time_t previous_ticks(const long tid) {
+    for (size_t i = 0; i < observer.num_tasks; ++i)
+        if (observer.tasks[i].tid == tid)
+            return observer.tasks[i].ticks;
+    return 0; // a thread started since the last sample, all of its time is new
+}
+
+// a thread's time since the last sample is charged to the cpu it ran on last,
+// which is exact for threads pinned to a single cpu and an estimate otherwise
+static void scan_tasks(const bool charge) {
+    DIR* dir = opendir(TASK_DIR);
+    if (!dir)
+        fatal("opendir");
+    TaskTicks tasks[MAX_OBSERVED_TASKS];
+    size_t num_tasks = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && num_tasks < MAX_OBSERVED_TASKS) {
+        long tid = strtol(entry->d_name, NULL, 10);
+        cpu_time_t ticks;
+        int cpu;
+        if (tid <= 0 || !read_task(tid, &ticks, &cpu))
+            continue;
+        cpu_time_t previous = previous_ticks(tid);
+        if (charge && ticks > previous && cpu >= 0 && cpu < observer.num_cpus) {
+            observer.self_ticks[0]       += ticks - previous;
+            observer.self_ticks[cpu + 1] += ticks - previous;
+        }
+        tasks[num_tasks++] = (TaskTicks){.tid = tid, .ticks = ticks};
+    }
+    if (closedir(dir) < 0)
+        fatal("closedir");
+    memcpy(observer.tasks, tasks, num_tasks * sizeof(TaskTicks));
+    observer.num_tasks = num_tasks;
+}
+
+void observer_init(const long num_cpus) {
+    observer.num_cpus   = num_cpus;
+    observer.self_ticks = checked_malloc((num_cpus + 1) * sizeof(cpu_time_t));
+    for (long i = 0; i <= num_cpus; ++i)
+        observer.self_ticks[i] = 0;
+    observer.num_tasks = 0;
+    scan_tasks(false); // what was spent before now isn't part of any sample
+}
+
+void observer_destroy() {
+    free(observer.self_ticks);
+}
+
+void observer_sample(cpu_time_t * const self_ticks) {
+    scan_tasks(true);
+    memcpy(self_ticks, observer.self_ticks, (observer.num_cpus + 1) * sizeof(cpu_time_t));
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Accounts for the tracker's own cpu time, per cpu, in the same clock ticks as /proc/stat -
+// so that the observer effect can be measured, and subtracted from what's being observed.
+
+#include "reader.h"
+
+void observer_init(const long num_cpus);
+void observer_destroy();
+void observer_sample(cpu_time_t * const self_ticks);
@@ -0,0 +1,203 @@
+#include "options.h"
+
+#include "shm.h"
+#include "exporter.h"
+#include "analyzer_pool.h"
+#include "frame.h"
+#include "util.h"
+#include "net.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * const usage_text =
+    "Usage: %s [OPTION]...\n"
+    "  -s, --shm[=NAME]  publish the latest usage to POSIX shared memory (default: " USAGE_SHM_DEFAULT_NAME ")\n"
+    "  -e, --exporter[=ADDR]\n"
+    "                    serve prometheus metrics on unix:PATH or a localhost PORT (default: " EXPORTER_DEFAULT_ADDR ")\n"
+    "  -r, --reactor     run every stage on a single event loop instead of a thread each\n"
+    "  -t, --adaptive    sample at 2 Hz while the usage is steady and at 20 Hz while it changes\n"
+    "  -j, --analyzer-threads N\n"
+    "                    split the analysis of every batch across N threads (default: 1)\n"
+    "  -d, --deadline WORKER=SECONDS\n"
+    "                    report WORKER (reader, analyzer, printer, logger) as stalled after SECONDS without progress\n"
+    "  -a, --alert RULE  report when RULE holds, e.g. \"cpu > 95 for 10s\" or \"node > 80 for 1min clear 70\"\n"
+    "  -A, --alert-out PATH\n"
+    "                    append alert events to PATH, or send them to unix:PATH (default: stderr)\n"
+    "  -p, --pin CPULIST pin the tracker's threads to housekeeping cpus, e.g. 0 or 0-1,4\n"
+    "  -f, --fifo PRIO   run the tracker's threads under SCHED_FIFO at PRIO (1-99)\n"
+    "  -n, --nice N      run the tracker's threads at nice level N (-20-19)\n"
+    "  -S, --stack-size KB\n"
+    "                    give every thread a stack of KB kilobytes\n"
+    "  -o, --observe-self\n"
+    "                    account for the tracker's own cpu time per cpu (exported as cut_self_usage_percent)\n"
+    "  -O, --subtract-self\n"
+    "                    and subtract it from the reported usage\n"
+    "  -F, --forward ADDR\n"
+    "                    stream every usage snapshot to a tracker_aggregator on unix:PATH or HOST:PORT\n"
+    "  -H, --host NAME   the name to forward under (default: the hostname)\n"
+    "  -i, --interval MS sample every MS milliseconds (default: 100), or at most that slowly with --adaptive\n"
+    "  -Y, --synthetic N make up the load of N cpus instead of reading /proc/stat\n"
+    "  -m, --format FORMAT\n"
+    "                    print the usage as screen, csv, json (lines) or binary (frames) (default: screen)\n"
+    "  -w, --output PATH print to PATH, a file or a fifo, instead of stdout\n"
+    "  -I, --irqs        show every cpu's busiest interrupt lines and softirqs\n"
+    "  -h, --help        display this help and exit\n";
+
+static const struct option long_options[] = {
+    {"shm",              optional_argument, NULL, 's'},
+    {"exporter",         optional_argument, NULL, 'e'},
+    {"reactor",          no_argument,       NULL, 'r'},
+    {"adaptive",         no_argument,       NULL, 't'},
+    {"analyzer-threads", required_argument, NULL, 'j'},
+    {"deadline",         required_argument, NULL, 'd'},
+    {"alert",            required_argument, NULL, 'a'},
+    {"alert-out",        required_argument, NULL, 'A'},
+    {"pin",              required_argument, NULL, 'p'},
+    {"fifo",             required_argument, NULL, 'f'},
+    {"nice",             required_argument, NULL, 'n'},
+    {"stack-size",       required_argument, NULL, 'S'},
+    {"observe-self",     no_argument,       NULL, 'o'},
+    {"subtract-self",    no_argument,       NULL, 'O'},
+    {"forward",          required_argument, NULL, 'F'},
+    {"host",             required_argument, NULL, 'H'},
+    {"interval",         required_argument, NULL, 'i'},
+    {"synthetic",        required_argument, NULL, 'Y'},
+    {"format",           required_argument, NULL, 'm'},
+    {"output",           required_argument, NULL, 'w'},
+    {"irqs",             no_argument,       NULL, 'I'},
+    {"help",             no_argument,       NULL, 'h'},
+    {NULL,               0,                 NULL,  0 },
+};
+
+static void parse_deadline(Options * const options, char * const spec, const char * const prog_name) {
+    char* sep = strchr(spec, '=');
+    char* end = NULL;
+    double seconds = sep ? strtod(sep + 1, &end) : 0;
+    if (!sep || end == sep + 1 || *end != '\0' || seconds <= 0 || options->num_deadlines == MAX_DEADLINES) {
+        fprintf(stderr, usage_text, prog_name);
+        exit(EXIT_FAILURE);
+    }
+    *sep = '\0'; // the worker's name ends here
+    options->deadlines[options->num_deadlines++] = (DeadlineOption){
+        .worker = spec,
+        .millis = (long)(seconds * 1000),
+    };
+}
+
+static void parse_alert(Options * const options, const char * const text, const char * const prog_name) {
+    if (options->num_alert_rules == MAX_ALERT_RULES || !parse_alert_rule(text, options->alert_rules + options->num_alert_rules)) {
+        fprintf(stderr, "%s: invalid alert rule '%s'\n", prog_name, text);
+        fprintf(stderr, usage_text, prog_name);
+        exit(EXIT_FAILURE);
+    }
+    options->num_alert_rules++;
+}
+
+Options parse_options(const int argc, char * const argv[]) {
+    Options options = {
+        .shm_name         = NULL,
+        .exporter_addr    = NULL,
+        .reactor          = false,
+        .adaptive         = false,
+        .analyzer_threads = 1,
+        .num_deadlines    = 0,
+        .num_alert_rules  = 0,
+        .alert_out        = NULL,
+        .tuning           = {.pin_list = NULL, .fifo_priority = 0, .nice = 0, .stack_size = 0},
+        .observe_self     = false,
+        .subtract_self    = false,
+        .forward_addr     = NULL,
+        .host_name        = NULL,
+        .interval_micros  = 0,
+        .synthetic_cpus   = 0,
+        .output_format    = FORMAT_SCREEN,
+        .output_path      = NULL,
+        .irqs             = false,
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s::e::rtj:d:a:A:p:f:n:S:oOF:H:i:Y:m:w:Ih", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                options.shm_name = optarg ? optarg : USAGE_SHM_DEFAULT_NAME;
+                break;
+            case 'e':
+                options.exporter_addr = optarg ? optarg : EXPORTER_DEFAULT_ADDR;
+                if (!unix_socket_path(options.exporter_addr)) // otherwise a port
+                    parse_long_option(options.exporter_addr, 1, MAX_PORT, usage_text, argv[0]);
+                break;
+            case 'r':
+                options.reactor = true;
+                break;
+            case 't':
+                options.adaptive = true;
+                break;
+            case 'j':
+                options.analyzer_threads = parse_long_option(optarg, 1, MAX_ANALYZER_THREADS, usage_text, argv[0]);
+                break;
+            case 'd':
+                parse_deadline(&options, optarg, argv[0]);
+                break;
+            case 'a':
+                parse_alert(&options, optarg, argv[0]);
+                break;
+            case 'A':
+                options.alert_out = optarg;
+                break;
+            case 'p':
+                options.tuning.pin_list = optarg;
+                break;
+            case 'f':
+                options.tuning.fifo_priority = parse_long_option(optarg, 1, 99, usage_text, argv[0]);
+                break;
+            case 'n':
+                options.tuning.nice = parse_long_option(optarg, -20, 19, usage_text, argv[0]);
+                break;
+            case 'S':
+                options.tuning.stack_size = parse_long_option(optarg, 1, 1024 * 1024, usage_text, argv[0]) * 1024;
+                break;
+            case 'o':
+                options.observe_self = true;
+                break;
+            case 'O':
+                options.observe_self  = true; // there's nothing to subtract without observing
+                options.subtract_self = true;
+                break;
+            case 'F':
+                options.forward_addr = optarg;
+                break;
+            case 'H':
+                options.host_name = optarg;
+                break;
+            case 'i':
+                options.interval_micros = parse_long_option(optarg, 1, 60000, usage_text, argv[0]) * 1000;
+                break;
+            case 'Y':
+                options.synthetic_cpus = parse_long_option(optarg, 1, FRAME_MAX_VALUES - 1, usage_text, argv[0]);
+                break;
+            case 'm':
+                if (!parse_output_format(optarg, &options.output_format)) {
+                    fprintf(stderr, "%s: unknown format '%s'\n", argv[0], optarg);
+                    fprintf(stderr, usage_text, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                options.output_path = optarg;
+                break;
+            case 'I':
+                options.irqs = true;
+                break;
+            case 'h':
+                printf(usage_text, argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, usage_text, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    return options;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "alert.h"
+#include "tuning.h"
+#include "output.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_DEADLINES 8
+
+typedef struct {
+    const char* worker;
+    long millis;
+} DeadlineOption;
+
+typedef struct {
+    const char* shm_name;      // NULL unless the usage should be published to shared memory
+    const char* exporter_addr; // NULL unless the metrics should be served
+    bool reactor;              // a single event loop instead of a thread per stage
+    bool adaptive;             // sample slowly while nothing changes
+    size_t analyzer_threads;   // the analysis of a batch is split across this many
+    DeadlineOption deadlines[MAX_DEADLINES]; // the watchdog's per-worker overrides
+    size_t num_deadlines;
+    AlertRule alert_rules[MAX_ALERT_RULES];
+    size_t num_alert_rules;
+    const char* alert_out;     // NULL for stderr
+    ThreadTuning tuning;
+    bool observe_self;         // account for the tracker's own cpu time
+    bool subtract_self;        // and take it out of the reported usage
+    const char* forward_addr;  // NULL unless the usage should be streamed to an aggregator
+    const char* host_name;     // what the aggregator knows this tracker by, NULL for the hostname
+    long interval_micros;      // 0 for the default sampling rate
+    long synthetic_cpus;       // 0 unless the load should be made up, for testing an aggregator
+    output_format_t output_format;
+    const char* output_path;   // NULL for stdout
+    bool irqs;                 // break the interrupts down per source
+} Options;
+
+Options parse_options(const int argc, char * const argv[]);
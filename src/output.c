@@ -0,0 +1,334 @@
+#include "output.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+#include "clock.h"
+#include "frame.h"
+#include "stats.h"
+#include "printer.h"
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#define FIELD_LEN 24 // the longest column name or value, with the punctuation around it
+#define FIXED_LEN 96 // the timestamps and the line's own punctuation
+#define SCHED_LEN 384 // the run queue and pressure fields of a json line
+#define IRQ_LEN   (16 + IRQ_TOP_SOURCES * (IRQ_NAME_LEN + 32)) // a cpu's busiest sources in a json line
+#define MAX_OUTPUTS 4
+
+const char * const format_names[NUM_FORMATS] = {"screen", "csv", "json", "binary"};
+
+struct Output {
+    int fd;
+    int fd_flags;           // restored on the way out, in case the description is shared with another process
+    output_format_t format;
+    char host[FRAME_MAX_HOST_LEN + 1];
+    uint64_t seq;           // moves on for every record, dropped or not, so that a reader can tell
+    long header_cpus;       // the layout the csv header was written for, -1 before there was one
+    long header_groups;
+    char* buffer;           // the latest record, rendered straight from the usage
+    size_t capacity;
+    size_t len;
+    size_t pos;             // how much of it is out
+};
+
+bool parse_output_format(const char * const name, output_format_t * const format) {
+    for (size_t i = 0; i < NUM_FORMATS; ++i)
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = i;
+            return true;
+        }
+    return false;
+}
+
+// the flags to put back should the process exit without destroying its outputs, e.g. through fatal()
+static struct {
+    int fd;
+    int flags;
+} changed_flags[MAX_OUTPUTS];
+static size_t num_changed_flags;
+
+static void restore_flags() {
+    for (size_t i = 0; i < num_changed_flags; ++i)
+        fcntl(changed_flags[i].fd, F_SETFL, changed_flags[i].flags);
+}
+
+static void remember_flags(const int fd, const int flags) {
+    static bool registered = false;
+    if (!registered && atexit(restore_flags) != 0)
+        fatal("atexit");
+    registered = true;
+    if (num_changed_flags == MAX_OUTPUTS) {
+        errno = 0;
+        fatal("too many outputs");
+    }
+    changed_flags[num_changed_flags].fd    = fd;
+    changed_flags[num_changed_flags].flags = flags;
+    num_changed_flags++;
+}
+
+static void forget_flags(const int fd) {
+    for (size_t i = 0; i < num_changed_flags; ++i)
+        if (changed_flags[i].fd == fd) {
+            changed_flags[i] = changed_flags[--num_changed_flags];
+            return;
+        }
+}
+
+// a terminal or a pipe is opened anew, so that it's only our own description that turns non-blocking and
+// not the shell's; a regular file is shared along with its offset, but it never blocks anyway, and anything
+// else that can't be reopened (a socket) gets its flags back on the way out
+static int open_stdout() {
+    struct stat st;
+    if (fstat(STDOUT_FILENO, &st) < 0)
+        fatal("fstat");
+    if (S_ISCHR(st.st_mode) || S_ISFIFO(st.st_mode)) {
+        int fd = open("/proc/self/fd/1", O_WRONLY | O_NOCTTY | O_CLOEXEC);
+        if (fd >= 0)
+            return fd;
+    }
+    int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
+        fatal("fcntl");
+    return fd;
+}
+
+// takes a fifo as well as a file, which is overwritten
+int open_output(const char * const path) {
+    if (!path)
+        return open_stdout();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        vfatal("failed to open %s", path);
+    return fd;
+}
+
+// takes ownership of the fd
+Output* new_output(const int fd, const output_format_t format, const char * const host) {
+    Output* output = checked_malloc(sizeof(*output));
+    output->fd            = fd;
+    output->format        = format;
+    output->seq           = 0;
+    output->header_cpus   = -1;
+    output->header_groups = -1;
+    output->buffer        = NULL;
+    output->capacity      = 0;
+    output->len           = 0;
+    output->pos           = 0;
+    checked_snprintf(output->host, sizeof(output->host), "%s", host);
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        fatal("fstat");
+    if ((output->fd_flags = fcntl(fd, F_GETFL)) < 0)
+        fatal("fcntl");
+    if (S_ISREG(st.st_mode)) // a write to a file never waits for a reader
+        return output;
+    remember_flags(fd, output->fd_flags);
+    if (fcntl(fd, F_SETFL, output->fd_flags | O_NONBLOCK) < 0)
+        fatal("fcntl");
+    return output; // don't forget to free!
+}
+
+// the groups get columns only where there's more than one of them, like on the screen
+static long num_group_columns(const CpuUsage * const usage) {
+    long ncolumns = 0;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        if (usage->num_groups[level] > 1)
+            ncolumns += usage->num_groups[level];
+    return ncolumns;
+}
+
+static size_t max_record_len(const Output * const output, const CpuUsage * const usage) {
+    switch (output->format) {
+        case FORMAT_SCREEN:
+            return max_render_len(usage);
+        case FORMAT_BINARY:
+            return FRAME_MAX_LEN;
+        default: // a csv header and its line, or a json line
+            return (usage->length + num_group_columns(usage)) * 2 * FIELD_LEN + NUM_TOPO_LEVELS * FIELD_LEN + FIXED_LEN + SCHED_LEN
+                + (usage->irq ? usage->irq->num_cpus * IRQ_LEN : 0);
+    }
+}
+
+static size_t put_csv_value(char * const buffer, const size_t nleft, const cpu_usage_t value) {
+    return value == UNKNOWN_USAGE
+        ? checked_snprintf(buffer, nleft, ",")
+        : checked_snprintf(buffer, nleft, ",%.2f", value);
+}
+
+static size_t put_json_value(char * const buffer, const size_t nleft, const char * const sep, const cpu_usage_t value) {
+    return value == UNKNOWN_USAGE
+        ? checked_snprintf(buffer, nleft, "%snull", sep)
+        : checked_snprintf(buffer, nleft, "%s%.2f", sep, value);
+}
+
+// the header goes out again whenever the columns change, e.g. when a cpu is plugged in
+static size_t render_csv(Output * const output, const CpuUsage * const usage, const uint64_t millis) {
+    char* buffer = output->buffer;
+    const size_t capacity = output->capacity;
+    const long ngroups = num_group_columns(usage);
+    size_t pos = 0;
+    if (usage->length != output->header_cpus || ngroups != output->header_groups) {
+        pos += checked_snprintf(buffer + pos, capacity - pos, "time_ms,total");
+        for (long cpu = 1; cpu < usage->length; ++cpu)
+            pos += checked_snprintf(buffer + pos, capacity - pos, ",cpu%ld", cpu - 1);
+        for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+            for (long group = 0; usage->num_groups[level] > 1 && group < usage->num_groups[level]; ++group)
+                pos += checked_snprintf(buffer + pos, capacity - pos, ",%s%d",
+                    topo_level_names[level], usage->topology->group_id[level][group]);
+        pos += checked_snprintf(buffer + pos, capacity - pos, "\n");
+        output->header_cpus   = usage->length;
+        output->header_groups = ngroups;
+    }
+    pos += checked_snprintf(buffer + pos, capacity - pos, "%llu", (unsigned long long)millis);
+    for (long cpu = 0; cpu < usage->length; ++cpu)
+        pos += put_csv_value(buffer + pos, capacity - pos, usage->usage[cpu]);
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        for (long group = 0; usage->num_groups[level] > 1 && group < usage->num_groups[level]; ++group)
+            pos += put_csv_value(buffer + pos, capacity - pos, usage->group_usage[level][group]);
+    pos += checked_snprintf(buffer + pos, capacity - pos, "\n");
+    return pos;
+}
+
+static size_t render_json_sched(const SchedUsage * const sched, char * const buffer, const size_t capacity) {
+    size_t pos = put_json_value(buffer, capacity, ",\"sched\":{\"procs_running\":", sched->procs_running);
+    pos += put_json_value(buffer + pos, capacity - pos, ",\"procs_blocked\":", sched->procs_blocked);
+    pos += put_json_value(buffer + pos, capacity - pos, ",\"running_per_cpu\":", sched->running_per_cpu);
+    pos += put_json_value(buffer + pos, capacity - pos, ",\"ctxt_per_sec\":", sched->ctxt_per_sec);
+    if (sched->psi) {
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"some_stall\":", sched->some_stall);
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"some_avg10\":", sched->some_avg10);
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"some_avg60\":", sched->some_avg60);
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"full_stall\":", sched->full_stall);
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"full_avg10\":", sched->full_avg10);
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"full_avg60\":", sched->full_avg60);
+    }
+    pos += checked_snprintf(buffer + pos, capacity - pos, "}");
+    return pos;
+}
+
+// "irqs":{"0":[{"source":"LOC","rate":250},{"source":"NET_RX","rate":120}]}, for the cpus that had any
+static size_t render_json_irqs(const IrqUsage * const irq, char * const buffer, const size_t capacity) {
+    size_t pos = checked_snprintf(buffer, capacity, ",\"irqs\":{");
+    bool first = true;
+    for (long cpu = 0; cpu < irq->num_cpus; ++cpu) {
+        const IrqRate* top = irq->top + cpu * IRQ_TOP_SOURCES;
+        if (top[0].rate == 0)
+            continue;
+        pos += checked_snprintf(buffer + pos, capacity - pos, "%s\"%ld\":[", first ? "" : ",", cpu);
+        for (size_t rank = 0; rank < IRQ_TOP_SOURCES && top[rank].rate > 0; ++rank)
+            pos += checked_snprintf(buffer + pos, capacity - pos, "%s{\"source\":\"%s\",\"rate\":%.0f}", rank ? "," : "",
+                irq->layout->names[top[rank].source], top[rank].rate);
+        pos += checked_snprintf(buffer + pos, capacity - pos, "]");
+        first = false;
+    }
+    pos += checked_snprintf(buffer + pos, capacity - pos, "}");
+    return pos;
+}
+
+// e.g. {"time_ms":1700000000000,"window_ms":1000,"total":12.50,"cpus":[10.00,null],"node":{"0":12.50,"1":3.10},"sched":{...}}
+static size_t render_json(Output * const output, const CpuUsage * const usage, const uint64_t millis) {
+    char* buffer = output->buffer;
+    const size_t capacity = output->capacity;
+    size_t pos = checked_snprintf(buffer, capacity, "{\"time_ms\":%llu,\"window_ms\":%llu", (unsigned long long)millis,
+        (unsigned long long)((usage->window_end_nanos - usage->window_start_nanos) / 1000000));
+    if (usage->length > 0)
+        pos += put_json_value(buffer + pos, capacity - pos, ",\"total\":", usage->usage[0]);
+    pos += checked_snprintf(buffer + pos, capacity - pos, ",\"cpus\":[");
+    for (long cpu = 1; cpu < usage->length; ++cpu)
+        pos += put_json_value(buffer + pos, capacity - pos, cpu > 1 ? "," : "", usage->usage[cpu]);
+    pos += checked_snprintf(buffer + pos, capacity - pos, "]");
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        if (usage->num_groups[level] <= 1)
+            continue;
+        pos += checked_snprintf(buffer + pos, capacity - pos, ",\"%s\":{", topo_level_names[level]);
+        for (long group = 0; group < usage->num_groups[level]; ++group) {
+            char key[FIELD_LEN];
+            checked_snprintf(key, sizeof(key), "%s\"%d\":", group > 0 ? "," : "", usage->topology->group_id[level][group]);
+            pos += put_json_value(buffer + pos, capacity - pos, key, usage->group_usage[level][group]);
+        }
+        pos += checked_snprintf(buffer + pos, capacity - pos, "}");
+    }
+    pos += render_json_sched(&usage->sched, buffer + pos, capacity - pos);
+    if (usage->irq)
+        pos += render_json_irqs(usage->irq, buffer + pos, capacity - pos);
+    pos += checked_snprintf(buffer + pos, capacity - pos, "}\n");
+    return pos;
+}
+
+// the records are stamped with the end of the window they cover, not with when they got written
+static size_t render_record(Output * const output, const CpuUsage * const usage, const uint64_t seq) {
+    const uint64_t nanos = realtime_of(usage->window_end_nanos);
+    switch (output->format) {
+        case FORMAT_SCREEN:
+            return render_usage(usage, output->buffer);
+        case FORMAT_CSV:
+            return render_csv(output, usage, nanos / 1000000);
+        case FORMAT_JSON:
+            return render_json(output, usage, nanos / 1000000);
+        case FORMAT_BINARY:
+            return encode_frame((uint8_t*)output->buffer, output->host, seq, nanos, usage->usage, usage->length);
+        default:
+            return 0;
+    }
+}
+
+bool output_flush(Output * const output) {
+    while (output->pos < output->len) {
+        ssize_t nwritten = write(output->fd, output->buffer + output->pos, output->len - output->pos);
+        if (nwritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (nwritten < 0)
+            fatal("write");
+        output->pos += nwritten;
+    }
+    return true;
+}
+
+// waits up to the timeout for the reader to make room for the rest of a stuck record
+bool output_wait_flush(Output * const output, const long timeout_millis) {
+    if (output_flush(output))
+        return true;
+    struct pollfd pfd = {.fd = output->fd, .events = POLLOUT};
+    if (poll(&pfd, 1, timeout_millis) < 0 && errno != EINTR)
+        fatal("poll");
+    return output_flush(output);
+}
+
+// a record only replaces the previous one once that's out in full, a reader would choke on a torn one
+bool output_usage(Output * const output, const CpuUsage * const usage) {
+    const uint64_t seq = output->seq++;
+    if (!output_flush(output)) {
+        stat_inc(STAT_RECORDS_DROPPED);
+        return false;
+    }
+    const size_t max_len = max_record_len(output, usage);
+    if (max_len > output->capacity) { // only ever when the cpus change, the buffer is reused otherwise
+        free(output->buffer);
+        output->buffer   = checked_malloc(max_len);
+        output->capacity = max_len;
+    }
+    output->len = render_record(output, usage, seq);
+    output->pos = 0;
+    output_flush(output); // whatever doesn't go out now goes out before the next record
+    return true;
+}
+
+int output_fd(const Output * const output) {
+    return output->fd;
+}
+
+void destroy_output(Output * const output) {
+    output_flush(output); // one last chance for a record that's stuck halfway
+    fcntl(output->fd, F_SETFL, output->fd_flags);
+    forget_flags(output->fd);
+    close(output->fd);
+    free(output->buffer);
+    free(output);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Where the printer's records go: the screen, or one line of CSV or JSON or one binary frame per usage
+// snapshot for whatever reads the other end of a pipe. The writes never block - a record that can't go
+// out while the previous one is still stuck is dropped and counted, a partly written one is finished first.
+
+#include "analyzer.h"
+
+#include <stdbool.h>
+
+typedef enum {
+    FORMAT_SCREEN,
+    FORMAT_CSV,
+    FORMAT_JSON,   // json lines, an object per line
+    FORMAT_BINARY, // the frames of frame.h, each led by its length
+    NUM_FORMATS
+} output_format_t;
+
+typedef struct Output Output;
+
+extern const char * const format_names[NUM_FORMATS];
+
+bool parse_output_format(const char * const name, output_format_t * const format);
+int open_output(const char * const path); // NULL for stdout
+Output* new_output(const int fd, const output_format_t format, const char * const host);
+bool output_usage(Output * const output, const CpuUsage * const usage); // false if the record was dropped
+bool output_flush(Output * const output); // true once nothing is left to write
+bool output_wait_flush(Output * const output, const long timeout_millis);
+int output_fd(const Output * const output);
+void destroy_output(Output * const output);
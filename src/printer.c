@@ -7,32 +7,111 @@
 #include <stdio.h>
 
 #define CPU_ID_MAX_DECIMAL_DIGITS 6
-#define INCOMPLETE_ROW_LEN        (sizeof("cpu : ###.##%\n"))
+#define INCOMPLETE_ROW_LEN        (sizeof("socket : ###.##%\n"))
 #define ROW_LEN                   (INCOMPLETE_ROW_LEN + CPU_ID_MAX_DECIMAL_DIGITS)
+#define ANSI_CLEAR                "\x1b[2J"
+#define SCHED_ROWS_LEN            256
+#define IRQ_ROW_LEN               (sizeof("irqs cpu : \n") + CPU_ID_MAX_DECIMAL_DIGITS + IRQ_TOP_SOURCES * (IRQ_NAME_LEN + 16))
 
-static const char* ansi_clear = "\x1b[2J";
+static size_t print_value(char * const buffer, const size_t nleft, const cpu_usage_t value) {
+    return value == UNKNOWN_USAGE
+        ? checked_snprintf(buffer, nleft, "UNKNOWN\n")
+        : checked_snprintf(buffer, nleft, "%.2f%%\n", value);
+}
+
+static size_t print_rate(char * const buffer, const size_t nleft, const char * const format, const float value) {
+    return value == UNKNOWN_USAGE
+        ? checked_snprintf(buffer, nleft, "UNKNOWN")
+        : checked_snprintf(buffer, nleft, format, value);
+}
+
+// right under the total, how hard the tasks compete for the cpus
+static size_t render_sched(const SchedUsage * const sched, char * const buffer) {
+    size_t pos = checked_snprintf(buffer, SCHED_ROWS_LEN, "run queue: %.2f running (", sched->procs_running);
+    pos += print_rate(buffer + pos, SCHED_ROWS_LEN - pos, "%.2f", sched->running_per_cpu);
+    pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, " per cpu), %.2f blocked, ", sched->procs_blocked);
+    pos += print_rate(buffer + pos, SCHED_ROWS_LEN - pos, "%.0f", sched->ctxt_per_sec);
+    pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, " switches/s\n");
+    if (!sched->psi)
+        return pos;
+    pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, "pressure: some ");
+    pos += print_rate(buffer + pos, SCHED_ROWS_LEN - pos, "%.2f%%", sched->some_stall);
+    pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, " (avg10 %.2f%%, avg60 %.2f%%)",
+        sched->some_avg10, sched->some_avg60);
+    if (sched->full_avg10 != UNKNOWN_USAGE) {
+        pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, ", full ");
+        pos += print_rate(buffer + pos, SCHED_ROWS_LEN - pos, "%.2f%%", sched->full_stall);
+        pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, " (avg10 %.2f%%, avg60 %.2f%%)",
+            sched->full_avg10, sched->full_avg60);
+    }
+    pos += checked_snprintf(buffer + pos, SCHED_ROWS_LEN - pos, "\n");
+    return pos;
+}
+
+// the busiest sources of every cpu that had any interrupts at all
+static size_t render_irqs(const IrqUsage * const irq, char * const buffer) {
+    size_t pos = 0;
+    for (long cpu = 0; cpu < irq->num_cpus; ++cpu) {
+        const IrqRate* top = irq->top + cpu * IRQ_TOP_SOURCES;
+        if (top[0].rate == 0)
+            continue;
+        size_t row_end = pos + IRQ_ROW_LEN;
+        pos += checked_snprintf(buffer + pos, row_end - pos, "irqs cpu %ld:", cpu);
+        for (size_t rank = 0; rank < IRQ_TOP_SOURCES && top[rank].rate > 0; ++rank)
+            pos += checked_snprintf(buffer + pos, row_end - pos, "%s %s %.0f/s", rank ? "," : "",
+                irq->layout->names[top[rank].source], top[rank].rate);
+        pos += checked_snprintf(buffer + pos, row_end - pos, "\n");
+    }
+    return pos;
+}
+
+static size_t num_group_rows(const CpuUsage * const usage) {
+    size_t nrows = 0;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        if (usage->num_groups[level] > 1) // a single group would just repeat the total
+            nrows += usage->num_groups[level];
+    return nrows;
+}
 
-static void clear_screen() {
-    printf("%s", ansi_clear);
-    fflush(stdout);
+size_t max_render_len(const CpuUsage * const usage) {
+    const size_t irq_len = usage->irq ? usage->irq->num_cpus * IRQ_ROW_LEN : 0;
+    return sizeof(ANSI_CLEAR) + SCHED_ROWS_LEN + (usage->length + num_group_rows(usage)) * ROW_LEN + irq_len;
 }
 
-void print_usage(CpuUsage usage) {
-    char buffer[usage.length * ROW_LEN];
-    size_t buf_pos = 0;
-    for (long cpu = 0; cpu < usage.length; ++cpu) {
+// draws the whole screen into the buffer (of at least max_render_len bytes), returns its length
+size_t render_usage(const CpuUsage * const usage, char * const buffer) {
+    size_t buf_pos = checked_snprintf(buffer, sizeof(ANSI_CLEAR), ANSI_CLEAR);
+    for (long cpu = 0; cpu < usage->length; ++cpu) {
         size_t nleft = ROW_LEN;
         size_t nprinted = cpu == 0
             ? checked_snprintf(buffer + buf_pos, nleft, "total: ")
             : checked_snprintf(buffer + buf_pos, nleft, "cpu %ld: ", cpu - 1);
         nleft   -= nprinted;
         buf_pos += nprinted;
-        buf_pos += usage.usage[cpu] == UNKNOWN_USAGE
-            ? checked_snprintf(buffer + buf_pos, nleft, "UNKNOWN\n")
-            : checked_snprintf(buffer + buf_pos, nleft, "%.2f%%\n", usage.usage[cpu]);
+        buf_pos += print_value(buffer + buf_pos, nleft, usage->usage[cpu]);
+        if (cpu == 0)
+            buf_pos += render_sched(&usage->sched, buffer + buf_pos);
     }
-    clear_screen();
-    if (write(STDOUT_FILENO, buffer, buf_pos) < 0)
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        if (usage->num_groups[level] <= 1)
+            continue;
+        for (long group = 0; group < usage->num_groups[level]; ++group) {
+            size_t nleft = ROW_LEN;
+            size_t nprinted = checked_snprintf(buffer + buf_pos, nleft, "%s %d: ", 
+                topo_level_names[level], usage->topology->group_id[level][group]);
+            nleft   -= nprinted;
+            buf_pos += nprinted;
+            buf_pos += print_value(buffer + buf_pos, nleft, usage->group_usage[level][group]);
+        }
+    }
+    if (usage->irq)
+        buf_pos += render_irqs(usage->irq, buffer + buf_pos);
+    return buf_pos;
+}
+
+void print_usage(const CpuUsage * const usage) {
+    char buffer[max_render_len(usage)];
+    size_t length = render_usage(usage, buffer);
+    if (write(STDOUT_FILENO, buffer, length) < 0) // clearing the screen in the same write avoids flicker
         fatal("write");
-    free_usage(usage);
 }
@@ -2,4 +2,8 @@
 
 #include "analyzer.h"
 
-void print_usage(CpuUsage usage);
+#include <stddef.h>
+
+size_t max_render_len(const CpuUsage * const usage);
+size_t render_usage(const CpuUsage * const usage, char * const buffer);
+void print_usage(const CpuUsage * const usage); // doesn't take ownership, the usage may be shared
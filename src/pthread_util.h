@@ -10,8 +10,10 @@
 #define PTHREAD_CHECK(func, x) \
 do {                           \
     int res = (x);             \
-    if (res != 0)              \
+    if (res != 0) {            \
+        errno = res;           \
         fatal(#func);          \
+    }                          \
 } while (0)
 
 typedef void* (*pthread_routine_t) (void*);
@@ -31,14 +33,15 @@ static inline void mtx_lock(pthread_mutex_t * const mtx) {
 static inline bool mtx_timed_lock(pthread_mutex_t * const mtx, const size_t nanos) {
     struct timespec timeoutTime;
     clock_gettime(CLOCK_REALTIME, &timeoutTime);
-    timeoutTime.tv_nsec += nanos;
+    timeoutTime.tv_sec  += (timeoutTime.tv_nsec + nanos) / 1000000000;
+    timeoutTime.tv_nsec  = (timeoutTime.tv_nsec + nanos) % 1000000000; // must stay below a second
 
     int ret = pthread_mutex_timedlock(mtx, &timeoutTime);
     if (ret == ETIMEDOUT)
         return false;
-    if (ret == 0)
-        return true;
-    fatal("pthread_mutex_timedlock");
+    if (ret != 0)
+        fatal("pthread_mutex_timedlock");
+    return true;
 }
 
 static inline void mtx_unlock(pthread_mutex_t * const mtx) {
@@ -61,8 +64,20 @@ static inline void cnd_wait(pthread_cond_t * const cnd, pthread_mutex_t * const
     PTHREAD_CHECK(pthread_cond_wait, pthread_cond_wait(cnd, mtx));
 }
 
-static inline void thr_spawn(pthread_t * const handle, pthread_routine_t routine, void * const ctx) {
-    PTHREAD_CHECK(pthread_create, pthread_create(handle, NULL, routine, ctx));
+// false once the deadline, on the realtime clock, has passed
+static inline bool cnd_timed_wait(pthread_cond_t * const cnd, pthread_mutex_t * const mtx, const struct timespec * const deadline) {
+    int ret = pthread_cond_timedwait(cnd, mtx, deadline);
+    if (ret == ETIMEDOUT)
+        return false;
+    if (ret != 0) {
+        errno = ret;
+        fatal("pthread_cond_timedwait");
+    }
+    return true;
+}
+
+static inline void thr_spawn(pthread_t * const handle, pthread_routine_t routine, void * const ctx, const pthread_attr_t * const attr) {
+    PTHREAD_CHECK(pthread_create, pthread_create(handle, attr, routine, ctx));
 }
 
 static inline void thr_join(const pthread_t handle, void** ret) {
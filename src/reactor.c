@@ -0,0 +1,176 @@
+#include "reactor.h"
+
+#include "err.h"
+#include "mem.h"
+#include "stats.h"
+#include "util.h"
+#include "reader.h"
+#include "stages.h"
+#include "output.h"
+#include "logger.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MAX_EVENTS 8
+
+typedef enum {
+    EV_TIMER,
+    EV_SIGNAL,
+    EV_OUTPUT,
+    EV_EXPORTER,
+} event_source_t;
+
+typedef struct {
+    int epoll_fd;
+    int timer_fd;
+    int signal_fd;
+    Output* output;
+    bool output_watched; // only while a record is stuck behind a slow terminal or pipe
+    CpuDataSample* samples;
+    size_t num_sampled;
+    bool first_batch; // just two samples in quick succession, for a usage right after startup
+    long interval_micros;
+    const Analysis* analysis;
+    Exporter* exporter;
+    AlertEngine* alerts;
+    Forwarder* forwarder;
+} Reactor;
+
+static void watch(Reactor * const reactor, const int op, const int fd, const uint32_t events, const event_source_t source) {
+    struct epoll_event ev = {.events = events, .data.u32 = source};
+    if (epoll_ctl(reactor->epoll_fd, op, fd, &ev) < 0)
+        fatal("epoll_ctl");
+}
+
+static void arm_timer(const int fd, const long interval_micros, const long first_micros) {
+    struct itimerspec spec = {
+        .it_interval = {.tv_sec = interval_micros / 1000000, .tv_nsec = interval_micros % 1000000 * 1000L},
+        .it_value    = {.tv_sec = first_micros / 1000000, .tv_nsec = MAX(first_micros % 1000000 * 1000L, 1)},
+    };
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+        fatal("timerfd_settime");
+}
+
+static int new_timer_fd() {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        fatal("timerfd_create");
+    arm_timer(fd, sampling_interval_micros(), 0); // the first sample right away
+    return fd;
+}
+
+static void flush_output(Reactor * const reactor) {
+    const bool flushed = output_flush(reactor->output);
+    if (flushed == !reactor->output_watched)
+        return;
+    watch(reactor, flushed ? EPOLL_CTL_DEL : EPOLL_CTL_ADD, output_fd(reactor->output), EPOLLOUT, EV_OUTPUT);
+    reactor->output_watched = !flushed;
+}
+
+// a record that didn't make it out in full holds back the next one, which is dropped
+static void print_stage(Reactor * const reactor, const CpuUsage * const usage) {
+    if (output_usage(reactor->output, usage))
+        stat_inc(STAT_USAGES_PRINTED);
+    flush_output(reactor);
+}
+
+static void on_timer(Reactor * const reactor) {
+    uint64_t expirations;
+    if (read(reactor->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        fatal("read");
+
+    if (!reactor->samples)
+        reactor->samples = new_samples();
+    read_sample(reactor->samples, reactor->num_sampled++);
+    if (sampling_interval_micros() != reactor->interval_micros) { // the adaptive rate has moved
+        reactor->interval_micros = sampling_interval_micros();
+        arm_timer(reactor->timer_fd, reactor->interval_micros, reactor->interval_micros);
+    }
+    if (reactor->first_batch && reactor->num_sampled == 1) { // the last sample comes next, and soon
+        reactor->num_sampled = NUM_SAMPLES - 1;
+        arm_timer(reactor->timer_fd, reactor->interval_micros, MIN(FIRST_BATCH_MICROS, reactor->interval_micros));
+        return;
+    }
+    if (reactor->num_sampled < NUM_SAMPLES)
+        return;
+    if (reactor->first_batch) {
+        fill_first_batch(reactor->samples);
+        reactor->first_batch = false;
+    }
+
+    stat_inc(STAT_BATCHES_READ);
+    CpuUsage usage = analyze_stage(reactor->analysis, reactor->samples);
+    reactor->samples     = NULL;
+    reactor->num_sampled = 0;
+    print_stage(reactor, &usage);
+    if (reactor->exporter)
+        exporter_update(reactor->exporter, &usage);
+    if (reactor->alerts)
+        alerts_evaluate(reactor->alerts, &usage, usage.window_end_nanos / 1000000);
+    if (reactor->forwarder)
+        forward_usage(reactor->forwarder, &usage);
+    free_usage(usage);
+}
+
+void run_reactor(const Analysis * const analysis, Output * const output, Exporter * const exporter, AlertEngine * const alerts,
+    Forwarder * const forwarder) {
+    Reactor reactor;
+    memset(&reactor, 0, sizeof(reactor));
+    reactor.analysis    = analysis;
+    reactor.output      = output;
+    reactor.exporter    = exporter;
+    reactor.alerts      = alerts;
+    reactor.forwarder   = forwarder;
+    reactor.first_batch = true;
+    if ((reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        fatal("epoll_create1");
+    reactor.timer_fd        = new_timer_fd();
+    reactor.interval_micros = sampling_interval_micros();
+    reactor.signal_fd       = new_signal_fd();
+
+    watch(&reactor, EPOLL_CTL_ADD, reactor.timer_fd, EPOLLIN, EV_TIMER);
+    watch(&reactor, EPOLL_CTL_ADD, reactor.signal_fd, EPOLLIN, EV_SIGNAL);
+    if (exporter)
+        watch(&reactor, EPOLL_CTL_ADD, exporter_fd(exporter), EPOLLIN, EV_EXPORTER);
+    log_info("[Reactor] starting work!");
+
+    bool running = true;
+    while (running) {
+        struct epoll_event events[MAX_EVENTS];
+        int nready = epoll_wait(reactor.epoll_fd, events, MAX_EVENTS, -1);
+        if (nready < 0 && errno != EINTR)
+            fatal("epoll_wait");
+        for (int i = 0; i < nready; ++i) {
+            switch (events[i].data.u32) {
+                case EV_TIMER:
+                    on_timer(&reactor);
+                    if (exporter) // every tick, since an idle connection raises no event of its own
+                        exporter_close_expired(exporter);
+                    break;
+                case EV_SIGNAL:
+                    fprintf(stderr, "Received a termination signal. Shutting down...\n");
+                    running = false;
+                    break;
+                case EV_OUTPUT:
+                    flush_output(&reactor);
+                    break;
+                case EV_EXPORTER:
+                    exporter_poll(exporter, 0);
+                    break;
+            }
+        }
+    }
+
+    log_warn("[Reactor] shutting down...");
+    if (reactor.samples)
+        free_samples(reactor.samples);
+    close(reactor.signal_fd);
+    close(reactor.timer_fd);
+    close(reactor.epoll_fd);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Runs the reader, analyzer, printer and logger stages on a single event loop,
+// driven by a timerfd and a signalfd instead of five threads waking each other up.
+
+#include "stages.h"
+#include "output.h"
+#include "exporter.h"
+#include "alert.h"
+#include "forwarder.h"
+
+void run_reactor(const Analysis * const analysis, Output * const output, Exporter * const exporter, AlertEngine * const alerts,
+    Forwarder * const forwarder);
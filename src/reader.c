@@ -3,16 +3,49 @@
 #include "err.h"
 #include "mem.h"
 #include "util.h"
+#include "clock.h"
+#include "observer.h"
+#include "adaptive.h"
 
+#include <linux/netlink.h>
+#include <sys/socket.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
 
-#define PROCSTATFILE  "/proc/stat"
-#define PROC_LINE_LEN 4096
-#define SAMPLING_FREQ 1e6
-#define FAIL          (-1)
+#define PROCSTATFILE    "/proc/stat"
+#define PSI_CPU_FILE    "/proc/pressure/cpu"
+#define INTERRUPTS_FILE "/proc/interrupts"
+#define SOFTIRQS_FILE   "/proc/softirqs"
+#define CPU_ONLINE_FILE "/sys/devices/system/cpu/online"
+#define CPU_DEVPATH     "@/devices/system/cpu/cpu"
+#define PROC_LINE_LEN   4096
+#define UEVENT_BUF_LEN  4096
+#define SKIP            (-2)
+
+#define SYNTHETIC_TICKS        100   // per cpu and sample
+#define SYNTHETIC_STEP         0.1f  // how far a synthetic cpu's load may wander between samples
+
+static struct {
+    long num_cpus;         // fixed at startup so that a core keeps its index across hotplugs
+    bool* online;
+    int uevent_fd;         // -1 if uevents aren't available and the online file has to be polled
+    unsigned long generation;
+    bool observe_self;
+    IrqReader* irq;        // NULL unless irqs are tracked
+    long interval_micros;
+    bool adaptive;
+    AdaptiveRate rate;     // unused at a fixed rate
+    // the synthetic source's state, NULL/unused when reading /proc/stat
+    bool synthetic;
+    float* load;    // every synthetic cpu's current busy share
+    CpuData* synthetic_data;
+    unsigned seed;
+} reader; // a singleton instance
 
 static inline bool starts_with(const char * const haystack, const char * const needle) {
    return strncmp(haystack, needle, strlen(needle)) == 0;
@@ -26,6 +59,60 @@ static inline void checked_sscanf(const char * const str, const char * const for
     va_end(args);    
 }
 
+static int open_uevent_socket() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // kernel uevents
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void read_online_cpus() {
+    char buffer[PROC_LINE_LEN];
+    if (read_small_file(CPU_ONLINE_FILE, buffer, sizeof(buffer)))
+        parse_cpu_list(buffer, reader.online, reader.num_cpus);
+    else // no sysfs, let /proc/stat alone decide
+        for (long i = 0; i < reader.num_cpus; ++i)
+            reader.online[i] = true;
+}
+
+// drains pending uevents without blocking, true if any of them was about a cpu - or might have been,
+// when the socket overflowed and the kernel dropped some of them
+static bool hotplug_event_pending() {
+    char buffer[UEVENT_BUF_LEN];
+    bool pending = false;
+    while (true) {
+        ssize_t nread = recv(reader.uevent_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+        if (nread < 0 && errno == ENOBUFS) {
+            pending = true; // the rest is still worth draining
+            continue;
+        }
+        if (nread <= 0)
+            return pending;
+        buffer[nread] = '\0';
+        if (strstr(buffer, CPU_DEVPATH)) // the header looks like "online@/devices/system/cpu/cpu3"
+            pending = true;
+    }
+}
+
+static void check_hotplug() {
+    if (reader.uevent_fd >= 0 && !hotplug_event_pending())
+        return;
+
+    bool old_online[reader.num_cpus];
+    memcpy(old_online, reader.online, sizeof(old_online));
+    read_online_cpus();
+    if (memcmp(old_online, reader.online, sizeof(old_online)) != 0)
+        reader.generation++;
+}
+
 static inline int get_data_aggregated(CpuData* cpu_data, const char * const buffer) {
     checked_sscanf(buffer, "cpu %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu",
         &cpu_data->user, &cpu_data->nice, &cpu_data->system, &cpu_data->idle, &cpu_data->io_wait, 
@@ -35,70 +122,215 @@ static inline int get_data_aggregated(CpuData* cpu_data, const char * const buff
     return 0;
 }
 
-static inline int get_data_for_core(CpuData* cpu_data, const char * const buffer, const long num_cpus) {
+static inline int get_data_for_core(CpuData* cpu_data, const char * const buffer) {
     CpuData temp;
     unsigned cpu_id;
     checked_sscanf(buffer, "cpu%4u %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu %16llu",
         &cpu_id, &temp.user, &temp.nice, &temp.system, &temp.idle, &temp.io_wait, 
         &temp.irq, &temp.soft_irq, &temp.steal, &temp.guest, &temp.guest_nice
     ); 
-    if (cpu_id + 1 > (unsigned)num_cpus)
-        return FAIL;
+    if (cpu_id + 1 > (unsigned)reader.num_cpus)
+        return SKIP;
     memcpy(cpu_data + cpu_id + 1, &temp, sizeof(CpuData));
-    cpu_data[cpu_id + 1].online = true;
+    // a core that is going down may still be listed, the online mask has the final say
+    cpu_data[cpu_id + 1].online = reader.online[cpu_id];
     return cpu_id + 1;
 }
 
-static inline int get_data(CpuData* cpu_data, FILE* procstat_file, const long num_cpus, const size_t line) {
+// one pass over the whole file: the cpu lines first, the scheduler's counters after them; a line
+// longer than the buffer (intr and softirq, on a big box) comes in pieces, which are skipped
+static void get_data(CpuDataSample * const sample, FILE * const procstat_file) {
     char buffer[PROC_LINE_LEN + 1];
-    if (!fgets(buffer, PROC_LINE_LEN, procstat_file))
-        return FAIL;
-    if (!starts_with(buffer, "cpu"))
-        return FAIL;
-    return line == 0 
-        ? get_data_aggregated(cpu_data, buffer)
-        : get_data_for_core(cpu_data, buffer, num_cpus);
-}
-
-static CpuDataSample get_sample() {
-    long num_cpus = sysconf(_SC_NPROCESSORS_CONF); // assume this as the upper bound for relevant lines
-    if (num_cpus < 0)
-        fatal("sysconf");
-    
+    bool line_start = true;
+    while (fgets(buffer, PROC_LINE_LEN, procstat_file)) {
+        const bool piece = !line_start;
+        line_start = strchr(buffer, '\n') != NULL;
+        if (piece)
+            continue;
+        if (starts_with(buffer, "cpu "))
+            get_data_aggregated(sample->cpu_data, buffer);
+        else if (starts_with(buffer, "cpu"))
+            get_data_for_core(sample->cpu_data, buffer);
+        else if (starts_with(buffer, "ctxt "))
+            checked_sscanf(buffer, "ctxt %llu", &sample->sched.ctxt);
+        else if (starts_with(buffer, "procs_running "))
+            checked_sscanf(buffer, "procs_running %lu", &sample->sched.procs_running);
+        else if (starts_with(buffer, "procs_blocked "))
+            checked_sscanf(buffer, "procs_blocked %lu", &sample->sched.procs_blocked);
+    }
+}
+
+// "some avg10=0.36 avg60=1.99 avg300=5.97 total=124494139", then the same for "full"
+static void get_pressure(SchedData * const sched) {
+    char buffer[PROC_LINE_LEN];
+    float avg300;
+    const int nfields = !read_small_file(PSI_CPU_FILE, buffer, sizeof(buffer)) ? 0
+        : sscanf(buffer, "some avg10=%f avg60=%f avg300=%f total=%llu full avg10=%f avg60=%f avg300=%f total=%llu",
+            &sched->some_avg10, &sched->some_avg60, &avg300, &sched->some_total,
+            &sched->full_avg10, &sched->full_avg60, &avg300, &sched->full_total);
+    sched->psi      = nfields >= 4;
+    sched->psi_full = nfields == 8;
+}
+
+// every cpu's load takes a random walk, so that many trackers on one machine look like different hosts
+static void get_synthetic_data(CpuData * const cpu_data) {
+    CpuData* total = reader.synthetic_data;
+    total->user = total->idle = 0;
+    for (long i = 1; i <= reader.num_cpus; ++i) {
+        float step = (rand_r(&reader.seed) / (float)RAND_MAX * 2 - 1) * SYNTHETIC_STEP;
+        reader.load[i] = MIN(1.0f, MAX(0.0f, reader.load[i] + step));
+        cpu_time_t busy = reader.load[i] * SYNTHETIC_TICKS + 0.5f;
+        CpuData* cpu = reader.synthetic_data + i;
+        cpu->user += busy;
+        cpu->idle += SYNTHETIC_TICKS - busy;
+        total->user += cpu->user;
+        total->idle += cpu->idle;
+    }
+    memcpy(cpu_data, reader.synthetic_data, (reader.num_cpus + 1) * sizeof(CpuData));
+}
+
+static void get_sample(CpuDataSample * const sample) {
+    sample->timestamp_nanos = monotonic_nanos();
+    sample->filled          = false;
+    memset(&sample->sched, 0, sizeof(sample->sched));
+    if (reader.synthetic) {
+        sample->length     = reader.num_cpus + 1;
+        sample->generation = 0;
+        sample->observed   = false;
+        get_synthetic_data(sample->cpu_data);
+        return;
+    }
     FILE* procstat_file = fopen(PROCSTATFILE, "r");
     if (!procstat_file)
         fatal("fopen");
 
-    CpuDataSample sample = {
-        .cpu_data = checked_malloc((num_cpus + 1) * sizeof(CpuData)),
-        .length = 0,
-    };
-
-    for (long i = 0; i < num_cpus + 1; ++i)
-        sample.cpu_data[i].online = false;
-    for (long i = 0; i < num_cpus + 1; ++i) {
-        int res = get_data(sample.cpu_data, procstat_file, num_cpus, i);
-        if (res == FAIL)
-            break; // end of relevant lines
-        sample.length = 1 + MAX(sample.length, res);
-    }
-    
+    sample->length     = reader.num_cpus + 1;
+    sample->generation = reader.generation;
+    sample->observed   = reader.observe_self;
+    for (long i = 0; i < sample->length; ++i)
+        sample->cpu_data[i].online = false;
+    get_data(sample, procstat_file);
     if (fclose(procstat_file) < 0)
         fatal("fclose");
-    return sample; // don't forget to free!
+    get_pressure(&sample->sched);
+
+    cpu_time_t self_ticks[sample->length];
+    if (reader.observe_self)
+        observer_sample(self_ticks);
+    for (long i = 0; i < sample->length; ++i)
+        sample->cpu_data[i].self = reader.observe_self ? self_ticks[i] : 0;
+}
+
+static void synthetic_init(const long num_cpus) {
+    reader.num_cpus       = num_cpus;
+    reader.load           = checked_malloc((num_cpus + 1) * sizeof(float));
+    reader.synthetic_data = checked_malloc((num_cpus + 1) * sizeof(CpuData));
+    reader.seed           = getpid();
+    memset(reader.synthetic_data, 0, (num_cpus + 1) * sizeof(CpuData));
+    for (long i = 0; i <= num_cpus; ++i) {
+        reader.load[i] = rand_r(&reader.seed) / (float)RAND_MAX;
+        reader.synthetic_data[i].online = true;
+    }
+}
+
+void reader_init(const ReaderConfig * const config) {
+    reader.synthetic      = config->synthetic_cpus > 0;
+    reader.load           = NULL;
+    reader.synthetic_data = NULL;
+    if (reader.synthetic)
+        synthetic_init(config->synthetic_cpus);
+    else if ((reader.num_cpus = sysconf(_SC_NPROCESSORS_CONF)) < 0) // the upper bound for relevant lines
+        fatal("sysconf");
+    const bool adaptive    = config->adaptive;
+    const long interval    = config->interval_micros ? config->interval_micros : SAMPLING_INTERVAL_MICROS;
+    reader.online          = checked_malloc(reader.num_cpus * sizeof(bool));
+    reader.uevent_fd       = reader.synthetic ? -1 : open_uevent_socket();
+    reader.generation      = 0;
+    reader.observe_self    = config->observe_self && !reader.synthetic; // there's no telling which made-up cpu it ran on
+    reader.adaptive        = adaptive;
+    reader.interval_micros = interval;
+    if (adaptive) { // with --interval as the slow rate
+        adaptive_rate_init(&reader.rate, reader.num_cpus, config->interval_micros ? interval : ADAPTIVE_BASE_INTERVAL_MICROS);
+        reader.interval_micros = reader.rate.interval_micros;
+    }
+    reader.irq             = config->irqs && !reader.synthetic
+        ? new_irq_reader(INTERRUPTS_FILE, SOFTIRQS_FILE, reader.num_cpus)
+        : NULL;
+    read_online_cpus();
+    if (reader.observe_self)
+        observer_init(reader.num_cpus);
+}
+
+void reader_destroy() {
+    if (reader.uevent_fd >= 0 && close(reader.uevent_fd) < 0)
+        fatal("close");
+    if (reader.observe_self)
+        observer_destroy();
+    if (reader.irq)
+        destroy_irq_reader(reader.irq);
+    free(reader.online);
+    if (reader.adaptive)
+        adaptive_rate_destroy(&reader.rate);
+    free(reader.load);
+    free(reader.synthetic_data);
+}
+
+// one allocation for the whole batch - the headers first, then every sample's cpu data
+CpuDataSample* new_samples() {
+    const size_t cpu_data_len = reader.num_cpus + 1;
+    CpuDataSample* samples = checked_malloc(NUM_SAMPLES * (sizeof(CpuDataSample) + cpu_data_len * sizeof(CpuData)));
+    CpuData* cpu_data = (CpuData*)(samples + NUM_SAMPLES);
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        samples[i].cpu_data = cpu_data + i * cpu_data_len;
+        samples[i].irq      = NULL;
+    }
+    return samples; // don't forget to free!
+}
+
+// for callers that pace the sampling themselves
+void read_sample(CpuDataSample * const samples, const size_t i) {
+    if (!reader.synthetic)
+        check_hotplug();
+    get_sample(samples + i);
+    if (reader.irq && (i == 0 || i == NUM_SAMPLES - 1)) // the analyzer only wants the batch's delta
+        samples[i].irq = irq_read(reader.irq);
+    if (reader.adaptive)
+        reader.interval_micros = adaptive_rate_update(&reader.rate, samples + i);
+}
+
+// for a first usage right after startup rather than a whole batch later: with only the first and the last
+// sample read, the ones in between repeat the first, and the analyzer skips their pairs as nothing ticked
+// and leaves them out of its averages
+void fill_first_batch(CpuDataSample * const samples) {
+    for (size_t i = 1; i < NUM_SAMPLES - 1; ++i) {
+        memcpy(samples[i].cpu_data, samples[0].cpu_data, samples[0].length * sizeof(CpuData));
+        samples[i].sched           = samples[0].sched;
+        samples[i].irq             = NULL;
+        samples[i].length          = samples[0].length;
+        samples[i].generation      = samples[0].generation;
+        samples[i].timestamp_nanos = samples[0].timestamp_nanos;
+        samples[i].observed        = samples[0].observed;
+        samples[i].filled          = true;
+    }
+}
+
+// how long to wait before the next sample
+long sampling_interval_micros() {
+    return reader.interval_micros;
 }
 
 CpuDataSample* get_samples() {
-    CpuDataSample* samples = checked_malloc(NUM_SAMPLES * sizeof(CpuDataSample));
+    CpuDataSample* samples = new_samples();
     for (size_t i = 0; i < NUM_SAMPLES; ++i) {
-        samples[i] = get_sample();
-        usleep(SAMPLING_FREQ / NUM_SAMPLES);
+        read_sample(samples, i);
+        usleep(sampling_interval_micros());
     }
     return samples; // don't forget to free!
 }
 
 void free_samples(CpuDataSample * const samples) {
     for (size_t i = 0; i < NUM_SAMPLES; ++i)
-        free(samples[i].cpu_data);
+        if (samples[i].irq)
+            free_irq_snapshot(samples[i].irq);
     free(samples);
 }
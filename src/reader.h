@@ -1,8 +1,14 @@
 #pragma once
 
+#include "irq.h"
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define NUM_SAMPLES 10
+#define NUM_SAMPLES                   10
+#define SAMPLING_INTERVAL_MICROS      (1000000 / NUM_SAMPLES)
+#define FIRST_BATCH_MICROS            50000  // between the only two samples of the very first batch
 
 typedef unsigned long long cpu_time_t;
 
@@ -17,13 +23,49 @@ typedef struct {
     cpu_time_t steal;
     cpu_time_t guest;
     cpu_time_t guest_nice;
+    cpu_time_t self; // the tracker's own share of the busy time, if observed
     bool online;
 } CpuData;
 
+// whether tasks are waiting for a cpu, which a busy cpu alone doesn't tell
+typedef struct {
+    unsigned long long ctxt;       // context switches since boot
+    unsigned long procs_running;   // runnable tasks, the running ones included
+    unsigned long procs_blocked;   // tasks waiting for io
+    bool psi;                      // whether there's a /proc/pressure/cpu to read the rest from
+    bool psi_full;                 // and a "full" line in it, which kernels before 5.13 leave out
+    float some_avg10;              // the kernel's averages of the share of time some task waited for a cpu
+    float some_avg60;
+    float full_avg10;              // every non-idle task at once
+    float full_avg60;
+    unsigned long long some_total; // micros stalled since boot
+    unsigned long long full_total;
+} SchedData;
+
 typedef struct {
     CpuData* cpu_data;
+    SchedData sched;
+    IrqSnapshot* irq;         // NULL but on a batch's first and last sample, and only if irqs are tracked
     long length;
+    unsigned long generation; // bumped whenever the set of online cpus changes
+    uint64_t timestamp_nanos; // monotonic, the samples of a batch need not be evenly spaced
+    bool observed;            // whether the tracker's own time is accounted for
+    bool filled;              // a copy of the first sample, standing in for one that wasn't read
 } CpuDataSample;
 
+typedef struct {
+    bool observe_self;    // account for the tracker's own cpu time
+    bool adaptive;        // sample slowly while nothing changes
+    long interval_micros; // the fixed rate (or the slow one, if adaptive), 0 for the default
+    long synthetic_cpus;  // 0 to read /proc/stat, otherwise made-up load on this many cpus
+    bool irqs;            // count every interrupt line and softirq per cpu as well
+} ReaderConfig;
+
+void reader_init(const ReaderConfig * const config);
+void reader_destroy();
+CpuDataSample* new_samples();
+void read_sample(CpuDataSample * const samples, const size_t i);
+void fill_first_batch(CpuDataSample * const samples);
+long sampling_interval_micros();
 CpuDataSample* get_samples();
 void free_samples(CpuDataSample * const samples);
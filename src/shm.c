@@ -0,0 +1,187 @@
+#include "shm.h"
+
+#include "util.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define MAX_READ_ATTEMPTS (1 << 20) // a writer that died mid-update must not hang its readers forever
+
+struct UsageShm {
+    UsageShmHeader* header;
+    size_t size;
+    char* name;        // only set for the owner, who unlinks it
+    dev_t dev;         // the owner's segment, so that it never unlinks a newer one under the same name
+    ino_t ino;
+    float* buffer;
+    uint32_t capacity; // the reader's, fixed at open - the header's may change under it, the mapping doesn't
+};
+
+static size_t segment_size(const uint32_t capacity) {
+    return sizeof(UsageShmHeader) + capacity * sizeof(float);
+}
+
+UsageShm* usage_shm_create(const char * const name, const uint32_t capacity) {
+    UsageShm* shm = calloc(1, sizeof(*shm));
+    if (!shm)
+        return NULL;
+    shm->size = segment_size(capacity);
+    if (!(shm->name = strdup(name))) {
+        free(shm);
+        return NULL;
+    }
+
+    // a segment of our own rather than one left over or still in use: resizing that would leave its
+    // readers with a mapping past the end of the file, and two writers would share one seqlock
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    struct stat st;
+    if (fd < 0 || ftruncate(fd, shm->size) < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(name);
+        }
+        free(shm->name);
+        free(shm);
+        return NULL;
+    }
+    shm->dev = st.st_dev;
+    shm->ino = st.st_ino;
+    shm->header = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the segment alive
+    if (shm->header == MAP_FAILED) {
+        shm_unlink(name);
+        free(shm->name);
+        free(shm);
+        return NULL;
+    }
+
+    UsageShmHeader* header = shm->header;
+    header->magic       = 0; // already zero, but the readers check it last
+    header->version     = USAGE_SHM_VERSION;
+    header->header_size = sizeof(UsageShmHeader);
+    header->capacity    = capacity;
+    header->length      = 0;
+    atomic_store_explicit(&header->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    header->magic = USAGE_SHM_MAGIC; // last, so a reader never sees a half-initialized header as valid
+    return shm;
+}
+
+void usage_shm_publish(UsageShm * const shm, const uint64_t timestamp_ns, const float * const usage, const uint32_t length,
+    const float * const * const groups, const long * const num_groups) {
+    UsageShmHeader* header = shm->header;
+    uint64_t seq = atomic_load_explicit(&header->seq, memory_order_relaxed);
+    atomic_store_explicit(&header->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    uint32_t pos = MIN(length, header->capacity);
+    memcpy(header->values, usage, pos * sizeof(float));
+    header->length = pos;
+    for (size_t level = 0; level < USAGE_SHM_LEVELS; ++level) {
+        uint32_t n = MIN((uint32_t)num_groups[level], header->capacity - pos);
+        if (n)
+            memcpy(header->values + pos, groups[level], n * sizeof(float));
+        header->num_groups[level] = n;
+        pos += n;
+    }
+    header->timestamp_ns = timestamp_ns;
+
+    atomic_store_explicit(&header->seq, seq + 2, memory_order_release);
+}
+
+// true if the name still refers to the segment the owner created
+static bool still_ours(const UsageShm * const shm) {
+    int fd = shm_open(shm->name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    const bool ours = fstat(fd, &st) == 0 && st.st_dev == shm->dev && st.st_ino == shm->ino;
+    close(fd);
+    return ours;
+}
+
+void usage_shm_destroy(UsageShm * const shm) {
+    munmap(shm->header, shm->size);
+    if (still_ours(shm))
+        shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
+
+UsageShm* usage_shm_open(const char * const name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(UsageShmHeader)) {
+        close(fd);
+        return NULL;
+    }
+    UsageShmHeader* header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        return NULL;
+
+    // nothing past the mapping is ever touched: the values stop at the capacity checked against the file's
+    // size here, and a segment is never resized once it's valid, only replaced by a new one
+    if (header->magic != USAGE_SHM_MAGIC || header->version != USAGE_SHM_VERSION
+        || header->header_size != sizeof(UsageShmHeader) || segment_size(header->capacity) > (size_t)st.st_size) {
+        munmap(header, st.st_size);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    UsageShm* shm = calloc(1, sizeof(*shm));
+    if (shm)
+        shm->buffer = calloc(header->capacity + 1, sizeof(float)); // +1 so that an empty segment still gets a buffer
+    if (!shm || !shm->buffer) {
+        free(shm);
+        munmap(header, st.st_size);
+        return NULL;
+    }
+    shm->header   = header;
+    shm->size     = st.st_size;
+    shm->capacity = header->capacity;
+    return shm;
+}
+
+bool usage_shm_snapshot(UsageShm * const shm, UsageSnapshot * const snapshot) {
+    const UsageShmHeader* header = shm->header;
+    const uint32_t capacity = shm->capacity; // what both the buffer and the mapping have room for
+
+    for (size_t attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+        uint64_t begin = atomic_load_explicit(&((UsageShmHeader*)header)->seq, memory_order_acquire);
+        if (begin & 1)
+            continue; // a write is in progress
+
+        snapshot->timestamp_ns = header->timestamp_ns;
+        snapshot->length       = MIN(header->length, capacity); // a torn read must not overflow the buffer
+        uint32_t num_values    = snapshot->length;
+        for (size_t level = 0; level < USAGE_SHM_LEVELS; ++level) {
+            snapshot->num_groups[level] = MIN(header->num_groups[level], capacity - num_values);
+            num_values += snapshot->num_groups[level];
+        }
+        memcpy(shm->buffer, header->values, num_values * sizeof(float));
+
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t end = atomic_load_explicit(&((UsageShmHeader*)header)->seq, memory_order_relaxed);
+        if (begin == end) {
+            snapshot->seq        = begin / 2;
+            snapshot->num_values = num_values;
+            snapshot->values     = shm->buffer;
+            return true;
+        }
+    }
+    return false;
+}
+
+void usage_shm_close(UsageShm * const shm) {
+    munmap(shm->header, shm->size);
+    free(shm->buffer);
+    free(shm);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Publication of the latest usage snapshot through POSIX shared memory.
+// The segment starts with a versioned header, the values are guarded by a seqlock,
+// so any number of local readers can take consistent snapshots without syscalls or locks.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USAGE_SHM_DEFAULT_NAME "/cut-usage"
+#define USAGE_SHM_MAGIC        0x53545543u // "CUTS"
+#define USAGE_SHM_VERSION      1u
+#define USAGE_SHM_LEVELS       4           // node, socket, core, llc - see topology.h
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t capacity;   // number of values the segment has room for
+    _Atomic uint64_t seq; // odd while a write is in progress
+    // everything below is only consistent when read under the seqlock
+    uint64_t timestamp_ns;
+    uint32_t length;     // per-cpu values, index 0 being the total
+    uint32_t num_groups[USAGE_SHM_LEVELS];
+    float values[];      // per-cpu values, then every level's groups in order
+} UsageShmHeader;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t timestamp_ns;
+    uint32_t length;
+    uint32_t num_groups[USAGE_SHM_LEVELS];
+    uint32_t num_values;
+    float* values;       // owned by the reader, valid until the next snapshot
+} UsageSnapshot;
+
+typedef struct UsageShm UsageShm;
+
+// publisher side, the tracker is the only writer
+UsageShm* usage_shm_create(const char * const name, const uint32_t capacity);
+void usage_shm_publish(UsageShm * const shm, const uint64_t timestamp_ns, const float * const usage, const uint32_t length,
+    const float * const * const groups, const long * const num_groups);
+void usage_shm_destroy(UsageShm * const shm);
+
+// reader side, returns NULL/false instead of dying - it's meant to be linked into other programs
+UsageShm* usage_shm_open(const char * const name);
+bool usage_shm_snapshot(UsageShm * const shm, UsageSnapshot * const snapshot);
+void usage_shm_close(UsageShm * const shm);
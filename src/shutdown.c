@@ -0,0 +1,58 @@
+#define _GNU_SOURCE // ppoll
+
+#include "shutdown.h"
+
+#include "err.h"
+#include "clock.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+static struct {
+    atomic_bool requested; // lock-free, so fine to set from a signal handler
+    int fd;
+} shutdown_state = {.fd = -1};
+
+void shutdown_init() {
+    atomic_init(&shutdown_state.requested, false);
+    if ((shutdown_state.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        fatal("eventfd");
+}
+
+void shutdown_destroy() {
+    if (close(shutdown_state.fd) < 0)
+        fatal("close");
+    shutdown_state.fd = -1;
+}
+
+// the eventfd is never read, whoever polls it from now on returns right away
+void request_shutdown() {
+    const int saved_errno = errno;
+    atomic_store(&shutdown_state.requested, true);
+    const uint64_t one = 1;
+    const ssize_t written = write(shutdown_state.fd, &one, sizeof(one));
+    (void)written; // fails only with the counter about to overflow, which leaves it readable all the same
+    errno = saved_errno; // whatever the signal interrupted mustn't notice
+}
+
+bool shutting_down() {
+    return atomic_load(&shutdown_state.requested);
+}
+
+// other signals don't cut the sleep short, only a shutdown does
+bool sleep_unless_shutdown(const long micros) {
+    const uint64_t deadline = monotonic_nanos() + micros * 1000ull;
+    struct pollfd pfd = {.fd = shutdown_state.fd, .events = POLLIN};
+    uint64_t now;
+    while (!shutting_down() && (now = monotonic_nanos()) < deadline) {
+        const uint64_t left = deadline - now;
+        const struct timespec timeout = {.tv_sec = left / 1000000000u, .tv_nsec = left % 1000000000u};
+        if (ppoll(&pfd, 1, &timeout, NULL) < 0 && errno != EINTR)
+            fatal("ppoll");
+    }
+    return !shutting_down();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// The one cue for every worker to stop. Whoever sleeps or polls waits on its eventfd, which stays readable
+// for good once the shutdown is requested, so nobody sits out the rest of an interval; the workers fed
+// through a queue are woken by the one upstream of them instead, once it's done and their queue is drained.
+
+#include <stdbool.h>
+
+void shutdown_init();
+void shutdown_destroy();
+void request_shutdown(); // async-signal-safe
+bool shutting_down();
+bool sleep_unless_shutdown(const long micros); // false if cut short by a shutdown
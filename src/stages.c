@@ -0,0 +1,38 @@
+#include "stages.h"
+
+#include "err.h"
+#include "stats.h"
+
+_Static_assert(USAGE_SHM_LEVELS == NUM_TOPO_LEVELS, "the shm layout must mirror the topology levels");
+
+static void publish_usage(UsageShm * const shm, const CpuUsage * const usage) {
+    usage_shm_publish(shm, usage->window_end_nanos, usage->usage, usage->length,
+        (const float * const *)usage->group_usage, usage->num_groups);
+}
+
+UsageShm* new_usage_shm(const char * const name, const CpuTopology * const topology) {
+    long capacity = topology->num_cpus + 1;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        capacity += topology->num_groups[level];
+    UsageShm* shm = usage_shm_create(name, capacity);
+    if (!shm)
+        vfatal("failed to create shared memory segment %s", name);
+    return shm;
+}
+
+// consumes the samples, the usage is to be freed by the caller (or whoever it's handed over to)
+CpuUsage analyze_stage(const Analysis * const analysis, CpuDataSample * const samples) {
+    CpuUsage usage;
+    if (analysis->pool) {
+        usage = pool_analyze(analysis->pool, samples, analysis->subtract_self);
+    } else {
+        usage = get_usage(samples);
+        if (analysis->subtract_self)
+            subtract_self_usage(&usage); // before aggregating, so that the groups are corrected as well
+        aggregate_usage(&usage, analysis->topology);
+    }
+    stat_inc(STAT_USAGES_ANALYZED);
+    if (analysis->shm)
+        publish_usage(analysis->shm, &usage);
+    return usage;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// The work of the pipeline's stages, shared by the threaded and the reactor mode.
+
+#include "analyzer.h"
+#include "topology.h"
+#include "shm.h"
+#include "analyzer_pool.h"
+
+typedef struct {
+    const CpuTopology* topology;
+    UsageShm* shm;       // NULL unless the usage is published to shared memory
+    bool subtract_self;  // the tracker's own time
+    AnalyzerPool* pool;  // NULL to analyze on the calling thread alone
+} Analysis;
+
+UsageShm* new_usage_shm(const char * const name, const CpuTopology * const topology);
+CpuUsage analyze_stage(const Analysis * const analysis, CpuDataSample * const samples);
@@ -0,0 +1,36 @@
+#include "stats.h"
+
+#include <stdatomic.h>
+
+const stat_info_t stat_info[NUM_STATS] = {
+    {"cut_batches_read_total",       "Sample batches read from /proc/stat"},
+    {"cut_usages_analyzed_total",    "Usage snapshots computed by the analyzer"},
+    {"cut_usages_printed_total",     "Usage snapshots printed"},
+    {"cut_logs_written_total",       "Log messages written by the logger"},
+    {"cut_scrapes_served_total",     "Metrics responses served by the exporter"},
+    {"cut_snapshots_dropped_total",  "Usage snapshots dropped for lagging subscribers"},
+    {"cut_worker_stalls_total",      "Workers reported by the watchdog for overrunning their deadline"},
+    {"cut_alerts_fired_total",       "Alerts fired by the alert rules"},
+    {"cut_alert_events_lost_total",  "Alert events that couldn't be written out"},
+    {"cut_sampling_rate_changes_total", "Changes of the adaptive sampling interval"},
+    {"cut_frames_forwarded_total",   "Usage frames sent to the aggregator"},
+    {"cut_frames_dropped_total",     "Usage frames dropped for a slow or unreachable aggregator"},
+    {"cut_logs_suppressed_total",    "Log messages dropped by their call site's rate limit"},
+    {"cut_logs_coalesced_total",     "Log messages folded into a repeat count of the previous one"},
+    {"cut_output_records_dropped_total", "Output records dropped for a slow reader of the output"},
+    {"cut_scrapes_expired_total",    "Exporter connections closed for overrunning their deadline"},
+};
+
+static _Atomic uint64_t counters[NUM_STATS]; // a singleton, zeroed as a static
+
+void stat_inc(const stat_id_t id) {
+    atomic_fetch_add_explicit(counters + id, 1, memory_order_relaxed);
+}
+
+void stat_add(const stat_id_t id, const uint64_t n) {
+    atomic_fetch_add_explicit(counters + id, n, memory_order_relaxed);
+}
+
+uint64_t stat_get(const stat_id_t id) {
+    return atomic_load_explicit(counters + id, memory_order_relaxed);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// The tracker's own health counters, cheap enough to bump from any worker.
+
+#include <stdint.h>
+
+typedef enum {
+    STAT_BATCHES_READ,
+    STAT_USAGES_ANALYZED,
+    STAT_USAGES_PRINTED,
+    STAT_LOGS_WRITTEN,
+    STAT_SCRAPES_SERVED,
+    STAT_SNAPSHOTS_DROPPED,
+    STAT_STALLS,
+    STAT_ALERTS_FIRED,
+    STAT_ALERT_EVENTS_LOST,
+    STAT_RATE_CHANGES,
+    STAT_FRAMES_FORWARDED,
+    STAT_FRAMES_DROPPED,
+    STAT_LOGS_SUPPRESSED,
+    STAT_LOGS_COALESCED,
+    STAT_RECORDS_DROPPED,
+    STAT_SCRAPES_EXPIRED,
+    NUM_STATS
+} stat_id_t;
+
+typedef struct {
+    const char * const name; // a prometheus-friendly metric name
+    const char * const help;
+} stat_info_t;
+
+extern const stat_info_t stat_info[NUM_STATS];
+
+void stat_inc(const stat_id_t id);
+void stat_add(const stat_id_t id, const uint64_t n);
+uint64_t stat_get(const stat_id_t id);
@@ -0,0 +1,345 @@
+// A soak test for the handoff between workers: producers push into a chain of stages through the
+// tracker's own worker.c handoff, as fast as they can, for as long as asked.
+// The last stage checks that every producer's items arrive in order, none lost and none twice, and
+// measures how long they took to get through. Stalls can be injected into it for the watchdog to catch.
+
+#include "../err.h"
+#include "../mem.h"
+#include "../util.h"
+#include "../clock.h"
+#include "../queue.h"
+#include "../worker.h"
+#include "../stats.h"
+#include "../watchdog.h"
+#include "../pthread_util.h"
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PRODUCERS          64
+#define MAX_STAGES             8
+#define WATCHDOG_PERIOD_MICROS 50000
+#define SUB_BUCKETS            8 // per power of two, so that a percentile is off by less than 12.5%
+#define LATENCY_BUCKETS        (64 * SUB_BUCKETS)
+
+static const char * const usage_text =
+    "Usage: %s [OPTION]...\n"
+    "  -p, --producers N     push from N threads at once (default: 4)\n"
+    "  -s, --stages N        pass every item through a chain of N workers (default: 3)\n"
+    "  -d, --seconds N       keep pushing for N seconds (default: 10)\n"
+    "  -b, --backlog N       let at most N items wait in a stage's queue (default: 1024)\n"
+    "  -e, --stall-every N   stall the last stage after every N items (default: never)\n"
+    "  -m, --stall-ms MS     for MS milliseconds (default: 300)\n"
+    "  -w, --deadline-ms MS  the watchdog's deadline for every stage (default: 100)\n"
+    "  -h, --help            display this help and exit\n";
+
+static const struct option long_options[] = {
+    {"producers",   required_argument, NULL, 'p'},
+    {"stages",      required_argument, NULL, 's'},
+    {"seconds",     required_argument, NULL, 'd'},
+    {"backlog",     required_argument, NULL, 'b'},
+    {"stall-every", required_argument, NULL, 'e'},
+    {"stall-ms",    required_argument, NULL, 'm'},
+    {"deadline-ms", required_argument, NULL, 'w'},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL,          0,                 NULL,  0 },
+};
+
+typedef struct {
+    size_t producers;
+    size_t stages;
+    long seconds;
+    size_t backlog;
+    long stall_every;
+    long stall_millis;
+    long deadline_millis;
+} StressOptions;
+
+typedef struct {
+    uint32_t producer;
+    uint64_t seq;
+    uint64_t enqueued_nanos;
+} Item;
+
+typedef struct {
+    WorkerCtx self;
+    pthread_cond_t space;  // for whoever is pushing into a full backlog
+    size_t max_backlog;    // the deepest its queue has been
+    Heartbeat heartbeat;
+    char name[16];
+} Stage;
+
+typedef struct Harness Harness;
+
+typedef struct {
+    Harness* harness;
+    uint32_t id;
+} ProducerCtx;
+
+typedef struct {
+    Harness* harness;
+    size_t index;
+} StageCtx;
+
+struct Harness {
+    StressOptions options;
+    Stage stages[MAX_STAGES];
+    _Atomic bool stopping;  // the producers' cue
+    _Atomic bool finished;  // the watchdog's
+    uint64_t produced[MAX_PRODUCERS];
+    // the last stage's bookkeeping
+    uint64_t expected[MAX_PRODUCERS];
+    uint64_t consumed;
+    uint64_t lost;
+    uint64_t out_of_order;  // duplicated or reordered
+    uint64_t stalls_injected;
+    uint64_t max_latency;
+    uint64_t latency[LATENCY_BUCKETS];
+};
+
+static StressOptions parse_options(const int argc, char * const argv[]) {
+    StressOptions options = {
+        .producers       = 4,
+        .stages          = 3,
+        .seconds         = 10,
+        .backlog         = 1024,
+        .stall_every     = 0,
+        .stall_millis    = 300,
+        .deadline_millis = 100,
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:s:d:b:e:m:w:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                options.producers = parse_long_option(optarg, 1, MAX_PRODUCERS, usage_text, argv[0]);
+                break;
+            case 's':
+                options.stages = parse_long_option(optarg, 1, MAX_STAGES, usage_text, argv[0]);
+                break;
+            case 'd':
+                options.seconds = parse_long_option(optarg, 1, 24 * 3600, usage_text, argv[0]);
+                break;
+            case 'b':
+                options.backlog = parse_long_option(optarg, 1, 1 << 24, usage_text, argv[0]);
+                break;
+            case 'e':
+                options.stall_every = parse_long_option(optarg, 1, LONG_MAX, usage_text, argv[0]);
+                break;
+            case 'm':
+                options.stall_millis = parse_long_option(optarg, 1, 60000, usage_text, argv[0]);
+                break;
+            case 'w':
+                options.deadline_millis = parse_long_option(optarg, 1, 60000, usage_text, argv[0]);
+                break;
+            case 'h':
+                printf(usage_text, argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, usage_text, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    return options;
+}
+
+// log-linear: the power of two, then the next few bits below it
+static size_t latency_bucket(const uint64_t nanos) {
+    if (nanos < SUB_BUCKETS)
+        return nanos;
+    const unsigned msb = 63 - __builtin_clzll(nanos);
+    return (msb - 2) * SUB_BUCKETS + ((nanos >> (msb - 3)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_upper_bound(const size_t bucket) {
+    const size_t next = bucket + 1;
+    if (next < SUB_BUCKETS)
+        return next;
+    return (uint64_t)(SUB_BUCKETS + next % SUB_BUCKETS) << (next / SUB_BUCKETS + 2 - 3);
+}
+
+// the tracker's handoff, except that a full backlog makes the pusher wait - which isn't a stall
+// of its own, so the watchdog is told it's waiting
+static void push(Harness * const harness, Stage * const stage, const Item * const item, Heartbeat * const pusher) {
+    mtx_lock(&stage->self.mtx);
+    const bool full = stage->self.job_queue.num_items >= harness->options.backlog;
+    if (full && pusher)
+        atomic_store(&pusher->waiting, true);
+    while (stage->self.job_queue.num_items >= harness->options.backlog)
+        cnd_wait(&stage->space, &stage->self.mtx);
+    if (full && pusher)
+        atomic_store(&pusher->waiting, false);
+    worker_push_back_locked(&stage->self, item);
+    stage->max_backlog = MAX(stage->max_backlog, stage->self.job_queue.num_items);
+    mtx_unlock(&stage->self.mtx);
+}
+
+// false once nothing more is coming and the queue is drained
+static bool pop(Stage * const stage, Item * const item) {
+    mtx_lock(&stage->self.mtx);
+    if (!should_continue_work(&stage->self, &stage->heartbeat))
+        return false;
+    *item = *(Item*)queue_front(&stage->self.job_queue);
+    queue_pop_front(&stage->self.job_queue);
+    cnd_signal(&stage->space);
+    mtx_unlock(&stage->self.mtx);
+    return true;
+}
+
+static void* producer_work(void* arg) {
+    Harness* harness = ((ProducerCtx*)arg)->harness;
+    const uint32_t id = ((ProducerCtx*)arg)->id;
+    uint64_t seq = 0;
+    while (!atomic_load_explicit(&harness->stopping, memory_order_relaxed)) {
+        Item item = {.producer = id, .seq = seq++, .enqueued_nanos = monotonic_nanos()};
+        push(harness, harness->stages, &item, NULL);
+    }
+    harness->produced[id] = seq;
+    return NULL;
+}
+
+static void check_item(Harness * const harness, const Item * const item) {
+    uint64_t* expected = harness->expected + item->producer;
+    if (item->seq < *expected) {
+        harness->out_of_order++;
+        return;
+    }
+    harness->lost += item->seq - *expected;
+    *expected = item->seq + 1;
+    harness->consumed++;
+
+    const uint64_t latency = monotonic_nanos() - item->enqueued_nanos;
+    harness->latency[latency_bucket(latency)]++;
+    harness->max_latency = MAX(harness->max_latency, latency);
+}
+
+static void* stage_work(void* arg) {
+    Harness* harness   = ((StageCtx*)arg)->harness;
+    const size_t index = ((StageCtx*)arg)->index;
+    Stage* stage       = harness->stages + index;
+    const bool last    = index == harness->options.stages - 1;
+
+    Item item;
+    while (pop(stage, &item)) {
+        if (!last) {
+            push(harness, stage + 1, &item, &stage->heartbeat);
+            continue;
+        }
+        check_item(harness, &item);
+        if (harness->options.stall_every && harness->consumed % harness->options.stall_every == 0) {
+            usleep(harness->options.stall_millis * 1000);
+            harness->stalls_injected++;
+        }
+    }
+    if (!last)
+        order_termination(&stage[1].self);
+    return NULL;
+}
+
+static void* watchdog_work(void* arg) {
+    Harness* harness = (Harness*)arg;
+    while (!atomic_load(&harness->finished)) {
+        usleep(WATCHDOG_PERIOD_MICROS);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (size_t i = 0; i < harness->options.stages; ++i)
+            check_heartbeat(&harness->stages[i].heartbeat, harness->stages[i].name, &now);
+    }
+    return NULL;
+}
+
+static uint64_t percentile(const Harness * const harness, const double fraction) {
+    const uint64_t rank = harness->consumed * fraction;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+        if ((seen += harness->latency[i]) > rank)
+            return MIN(bucket_upper_bound(i), harness->max_latency);
+    return harness->max_latency;
+}
+
+// true if nothing went missing, nothing arrived twice or out of order, and every stall was caught
+static bool report(const Harness * const harness, const double seconds) {
+    uint64_t produced = 0;
+    bool tails_ok = true;
+    for (size_t i = 0; i < harness->options.producers; ++i) {
+        produced += harness->produced[i];
+        tails_ok &= harness->expected[i] == harness->produced[i]; // nothing lost at the very end either
+    }
+    const uint64_t detected = stat_get(STAT_STALLS);
+
+    printf("stress: %zu producers, %zu stages, backlog %zu, %.1f s\n",
+        harness->options.producers, harness->options.stages, harness->options.backlog, seconds);
+    printf("  items:    %llu produced, %llu consumed (%.0f/s), %llu lost, %llu duplicated or reordered\n",
+        (unsigned long long)produced, (unsigned long long)harness->consumed, harness->consumed / seconds,
+        (unsigned long long)harness->lost, (unsigned long long)harness->out_of_order);
+    printf("  latency:  p50 %.1f us, p99 %.1f us, p99.9 %.1f us, p99.99 %.1f us, max %.1f us\n",
+        percentile(harness, 0.5) / 1e3, percentile(harness, 0.99) / 1e3, percentile(harness, 0.999) / 1e3,
+        percentile(harness, 0.9999) / 1e3, harness->max_latency / 1e3);
+    printf("  backlog:  ");
+    for (size_t i = 0; i < harness->options.stages; ++i)
+        printf("%s%s max %zu", i ? ", " : "", harness->stages[i].name, harness->stages[i].max_backlog);
+    printf("\n  stalls:   %llu injected, %llu detected\n",
+        (unsigned long long)harness->stalls_injected, (unsigned long long)detected);
+
+    const bool ok = harness->lost == 0 && harness->out_of_order == 0 && tails_ok
+        && harness->consumed == produced && detected >= harness->stalls_injected;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    Harness* harness = checked_malloc(sizeof(*harness));
+    memset(harness, 0, sizeof(*harness));
+    harness->options = parse_options(argc, argv);
+    atomic_init(&harness->stopping, false);
+    atomic_init(&harness->finished, false);
+    // a stall has to outlast the deadline and the watchdog's period to be reported for sure
+    if (harness->options.stall_every && harness->options.stall_millis <= harness->options.deadline_millis + 2 * WATCHDOG_PERIOD_MICROS / 1000)
+        fprintf(stderr, "warning: stalls this short may go unnoticed\n");
+
+    const size_t num_stages = harness->options.stages;
+    for (size_t i = 0; i < num_stages; ++i) {
+        Stage* stage = harness->stages + i;
+        init_worker_ctx(&stage->self, sizeof(Item));
+        cnd_init(&stage->space);
+        heartbeat_init(&stage->heartbeat, harness->options.deadline_millis);
+        checked_snprintf(stage->name, sizeof(stage->name), "stage %zu", i);
+    }
+
+    const uint64_t started = monotonic_nanos();
+    pthread_t watchdog, stages[MAX_STAGES], producers[MAX_PRODUCERS];
+    StageCtx stage_ctx[MAX_STAGES];
+    ProducerCtx producer_ctx[MAX_PRODUCERS];
+    thr_spawn(&watchdog, watchdog_work, harness, NULL);
+    for (size_t i = 0; i < num_stages; ++i) {
+        stage_ctx[i] = (StageCtx){.harness = harness, .index = i};
+        thr_spawn(stages + i, stage_work, stage_ctx + i, NULL);
+    }
+    for (size_t i = 0; i < harness->options.producers; ++i) {
+        producer_ctx[i] = (ProducerCtx){.harness = harness, .id = i};
+        thr_spawn(producers + i, producer_work, producer_ctx + i, NULL);
+    }
+
+    sleep(harness->options.seconds);
+    atomic_store(&harness->stopping, true);
+    for (size_t i = 0; i < harness->options.producers; ++i)
+        thr_join(producers[i], NULL);
+    order_termination(&harness->stages[0].self); // the rest follow one by one, as each drains
+    for (size_t i = 0; i < num_stages; ++i)
+        thr_join(stages[i], NULL);
+    const double seconds = (monotonic_nanos() - started) / 1e9;
+    atomic_store(&harness->finished, true);
+    thr_join(watchdog, NULL);
+
+    bool ok = report(harness, seconds);
+    for (size_t i = 0; i < num_stages; ++i) {
+        destroy_worker_ctx(&harness->stages[i].self);
+        cnd_destroy(&harness->stages[i].space);
+    }
+    free(harness);
+    return !ok;
+}
@@ -3,16 +3,42 @@
 #endif
 
 #include "../mem.h"
+#include "../util.h"
 #include "../queue.h"
 #include "../reader.h"
+#include "../adaptive.h"
 #include "../analyzer.h"
+#include "../topology.h"
+#include "../shm.h"
+#include "../exporter.h"
+#include "../bus.h"
+#include "../alert.h"
+#include "../observer.h"
+#include "../frame.h"
+#include "../aggregator.h"
+#include "../net.h"
+#include "../analyzer_pool.h"
+#include "../irq.h"
 #include "../printer.h"
+#include "../output.h"
 #include "../logger.h"
+#include "../stats.h"
+#include "../clock.h"
+#include "../shutdown.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
 #define SIZE(x) (sizeof (x) / sizeof (x)[0])
 #define TEST(t) {#t, t}
@@ -98,7 +124,898 @@ static bool test_queue_big_items_push_then_pop() {
     return true;
 }
 
-//TODO: a test for pushes and pops intertwined
+// the front keeps chasing the back around the ring, across every regrowth
+static bool test_queue_pushes_and_pops_intertwined() {
+    const size_t nreps = 100000;
+    Queue q;
+    queue_init(&q, sizeof(size_t));
+
+    size_t pushed = 0, popped = 0;
+    for (size_t i = 0; i < nreps; ++i) {
+        for (size_t j = 0; j < i % 7 + 1; ++j, ++pushed)
+            queue_push_back(&q, &pushed);
+        for (size_t j = 0; j < i % 5 + 1 && !queue_empty(&q); ++j, ++popped) {
+            CHECK(*(size_t*)queue_front(&q) == popped);
+            queue_pop_front(&q);
+        }
+    }
+    while (!queue_empty(&q)) {
+        CHECK(*(size_t*)queue_front(&q) == popped++);
+        queue_pop_front(&q);
+    }
+    CHECK(pushed == popped);
+    queue_destroy(&q);
+    return true;
+}
+
+static bool test_aggregate_usage_by_topology() {
+    // 2 sockets/nodes, 2 cores each, 2 SMT threads per core: cpu i and i+4 are siblings
+    int node_of[]   = {0, 0, 1, 1, 0, 0, 1, 1};
+    int core_of[]   = {0, 1, 2, 3, 0, 1, 2, 3};
+    int node_ids[]  = {0, 1};
+    int core_ids[]  = {0, 1, 2, 3};
+    CpuTopology topology = {
+        .num_cpus   = 8,
+        .group_of   = {node_of, node_of, core_of, node_of},
+        .group_id   = {node_ids, node_ids, core_ids, node_ids},
+        .num_groups = {2, 2, 4, 2},
+    };
+
+    cpu_usage_t per_cpu[] = {0, 10, 20, 90, 100, 30, 40, UNKNOWN_USAGE, 80};
+    CpuUsage usage = {
+        .usage  = checked_malloc(sizeof(per_cpu)),
+        .length = SIZE(per_cpu),
+    };
+    memcpy(usage.usage, per_cpu, sizeof(per_cpu));
+
+    aggregate_usage(&usage, &topology);
+    CHECK(usage.topology == &topology);
+    CHECK(usage.num_groups[TOPO_CORE] == 4);
+    CHECK(usage.group_usage[TOPO_NODE][0] == 25.0f);   // cpus 0, 1, 4, 5
+    CHECK(usage.group_usage[TOPO_NODE][1] == 90.0f);   // cpus 2, 3, 7 (6 is unknown)
+    CHECK(usage.group_usage[TOPO_SOCKET][1] == 90.0f);
+    CHECK(usage.group_usage[TOPO_CORE][0] == 20.0f);   // cpus 0, 4
+    CHECK(usage.group_usage[TOPO_CORE][2] == 90.0f);   // cpu 2 only
+    CHECK(usage.group_usage[TOPO_LLC][0] == 25.0f);
+
+    print_usage(&usage);
+    free_usage(usage);
+    return true;
+}
+
+// every cpu busy for a different share of a second, sampled evenly, in the batch layout that free_samples
+// expects: the headers first, then the cpu data
+static CpuDataSample* new_test_samples(const long length) {
+    CpuDataSample* samples = checked_malloc(NUM_SAMPLES * (sizeof(CpuDataSample) + length * sizeof(CpuData)));
+    CpuData* cpu_data = (CpuData*)(samples + NUM_SAMPLES);
+    memset(cpu_data, 0, NUM_SAMPLES * length * sizeof(CpuData));
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        samples[i].cpu_data        = cpu_data + i * length;
+        samples[i].length          = length;
+        samples[i].generation      = 0;
+        samples[i].observed        = false;
+        samples[i].filled          = false;
+        samples[i].timestamp_nanos = i * 100000000u;
+        memset(&samples[i].sched, 0, sizeof(SchedData));
+        samples[i].irq             = NULL;
+        for (long cpu = 0; cpu < length; ++cpu) {
+            samples[i].cpu_data[cpu].user   = i * (cpu % 11);
+            samples[i].cpu_data[cpu].idle   = i * (10 - cpu % 11);
+            samples[i].cpu_data[cpu].online = cpu % 7 != 3;
+        }
+    }
+    return samples;
+}
+
+static bool test_usage_over_partial_window() {
+    const long length = 3;
+    CpuDataSample* samples = new_test_samples(length);
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        samples[i].generation      = i < NUM_SAMPLES / 2 ? 0 : 1;
+        samples[i].timestamp_nanos = 0;
+        for (long cpu = 0; cpu < length; ++cpu) {
+            samples[i].cpu_data[cpu].user = 50 * i;
+            samples[i].cpu_data[cpu].idle = 50 * i;
+            samples[i].cpu_data[cpu].online = true;
+        }
+        samples[i].cpu_data[1].online = i >= NUM_SAMPLES / 2; // came online halfway through
+        samples[i].cpu_data[2].online = false;                // never seen
+    }
+
+    CpuUsage usage = get_usage(samples);
+    CHECK(usage.length == length);
+    CHECK(usage.usage[0] == 50.0f);
+    CHECK(usage.usage[1] == 50.0f);
+    CHECK(usage.usage[2] == UNKNOWN_USAGE);
+    free_usage(usage);
+    return true;
+}
+
+#define SHM_TEST_NAME      "/cut-usage-test"
+#define SHM_TEST_CPUS      64
+#define SHM_TEST_READERS   4
+#define SHM_TEST_PUBLISHES 200000
+
+typedef struct {
+    atomic_bool* done;
+    size_t num_snapshots;
+    bool consistent;
+} shm_reader_arg_t;
+
+// the writer always fills a snapshot with one repeated number, so a torn read is easy to spot
+static void* shm_reader_routine(void* arg) {
+    shm_reader_arg_t* self = arg;
+    UsageShm* shm = usage_shm_open(SHM_TEST_NAME);
+    self->consistent = shm != NULL;
+    uint64_t last_seq = 0;
+    while (shm && self->consistent && !atomic_load(self->done)) {
+        UsageSnapshot snapshot;
+        if (!usage_shm_snapshot(shm, &snapshot))
+            continue;
+        self->consistent = snapshot.seq >= last_seq && snapshot.timestamp_ns == snapshot.seq;
+        for (uint32_t i = 0; i < snapshot.num_values; ++i)
+            self->consistent &= snapshot.values[i] == (float)snapshot.seq;
+        last_seq = snapshot.seq;
+        self->num_snapshots++;
+    }
+    if (shm)
+        usage_shm_close(shm);
+    return NULL;
+}
+
+static bool test_usage_weighted_by_interval() {
+    CpuDataSample* samples = new_test_samples(1);
+    // a second at 100% sampled slowly, then a second at 0% sampled at the fast rate
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        samples[i].timestamp_nanos  = i == 0 ? 0 : 1000000000u + (i - 1) * 1000000000u / (NUM_SAMPLES - 2);
+        samples[i].cpu_data[0].user = i == 0 ? 0 : 100;
+        samples[i].cpu_data[0].idle = i == 0 ? 0 : (i - 1) * 100 / (NUM_SAMPLES - 2);
+    }
+
+    CpuUsage usage = get_usage(samples);
+    CHECK(usage.usage[0] > 49.9f && usage.usage[0] < 50.1f); // rather than the 1 in 9 pairs that were busy
+    CHECK(usage.window_start_nanos == 0 && usage.window_end_nanos == 2000000000u);
+    free_usage(usage);
+    return true;
+}
+
+// one more sample of a single cpu that was busy for `busy` of the 10 ticks since the last one
+static long feed_adaptive_rate(AdaptiveRate * const rate, CpuDataSample * const sample, const cpu_time_t busy) {
+    sample->cpu_data[1].user += busy;
+    sample->cpu_data[1].idle += 10 - busy;
+    return adaptive_rate_update(rate, sample);
+}
+
+static bool test_adaptive_rate_jumps_holds_and_backs_off() {
+    CpuData cpu_data[2];
+    memset(cpu_data, 0, sizeof(cpu_data));
+    cpu_data[0].online = cpu_data[1].online = true;
+    CpuDataSample sample = {.cpu_data = cpu_data, .length = 2, .irq = NULL};
+    AdaptiveRate rate;
+    adaptive_rate_init(&rate, 1, ADAPTIVE_BASE_INTERVAL_MICROS);
+    CHECK(rate.interval_micros == ADAPTIVE_FAST_INTERVAL_MICROS); // until the usage is known to be steady
+
+    for (size_t i = 0; i < ADAPTIVE_HOLD_SAMPLES - 1; ++i)
+        CHECK(feed_adaptive_rate(&rate, &sample, 1) == ADAPTIVE_FAST_INTERVAL_MICROS);
+    // then halving the rate on every calm sample, down to the base
+    CHECK(feed_adaptive_rate(&rate, &sample, 1) == 2 * ADAPTIVE_FAST_INTERVAL_MICROS);
+    CHECK(feed_adaptive_rate(&rate, &sample, 1) == 4 * ADAPTIVE_FAST_INTERVAL_MICROS);
+    CHECK(feed_adaptive_rate(&rate, &sample, 1) == 8 * ADAPTIVE_FAST_INTERVAL_MICROS);
+    CHECK(feed_adaptive_rate(&rate, &sample, 1) == ADAPTIVE_BASE_INTERVAL_MICROS);
+    CHECK(feed_adaptive_rate(&rate, &sample, 2) == ADAPTIVE_BASE_INTERVAL_MICROS); // a few points are noise
+
+    CHECK(feed_adaptive_rate(&rate, &sample, 10) == ADAPTIVE_FAST_INTERVAL_MICROS); // busy and hot at once
+    size_t held = 1; // the level takes a few samples to catch up, each of which is a change of its own
+    while (feed_adaptive_rate(&rate, &sample, 10) == ADAPTIVE_FAST_INTERVAL_MICROS && held < 100)
+        ++held;
+    CHECK(held >= ADAPTIVE_HOLD_SAMPLES && held < ADAPTIVE_HOLD_SAMPLES + 5);
+    CHECK(rate.interval_micros == 2 * ADAPTIVE_FAST_INTERVAL_MICROS);
+    adaptive_rate_destroy(&rate);
+
+    adaptive_rate_init(&rate, 1, 20000); // an --interval below the fast rate is both rates
+    CHECK(rate.interval_micros == 20000);
+    CHECK(feed_adaptive_rate(&rate, &sample, 5) == 20000);
+    adaptive_rate_destroy(&rate);
+    return true;
+}
+
+static bool test_first_batch_from_two_samples() {
+    CpuDataSample* samples = new_test_samples(3); // only the first and the last one count
+    for (size_t i = 1; i < NUM_SAMPLES - 1; ++i)
+        samples[i].cpu_data[1].user = 1000; // garbage, to be overwritten
+    samples[0].sched.procs_running               = 9;
+    samples[NUM_SAMPLES - 1].sched.procs_running = 1;
+    samples[NUM_SAMPLES - 1].sched.procs_blocked = 2;
+    fill_first_batch(samples);
+    CHECK(samples[NUM_SAMPLES / 2].cpu_data[1].user == samples[0].cpu_data[1].user);
+    CHECK(samples[NUM_SAMPLES / 2].timestamp_nanos == samples[0].timestamp_nanos);
+
+    CpuUsage usage = get_usage(samples);
+    CHECK(usage.usage[1] > 9.9f && usage.usage[1] < 10.1f);
+    CHECK(usage.usage[2] > 19.9f && usage.usage[2] < 20.1f);
+    CHECK(usage.sched.procs_running == 5.0f && usage.sched.procs_blocked == 1.0f); // not nine parts the first
+    free_usage(usage);
+    return true;
+}
+
+static bool test_sched_usage_from_counters() {
+    CpuDataSample* samples = new_test_samples(3); // the total and two cpus, sampled every 100 ms
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        SchedData* sched = &samples[i].sched;
+        sched->ctxt          = 5000 + i * 100;
+        sched->procs_running = 6;
+        sched->procs_blocked = i % 2;
+        sched->psi           = true;
+        sched->psi_full      = true;
+        sched->some_avg10    = i;
+        sched->some_total    = 1000000 + i * 50000; // stalled for half of every interval
+        sched->full_total    = i * 10000;
+    }
+    CpuUsage usage = get_usage(samples);
+    const SchedUsage* sched = &usage.sched;
+    CHECK(sched->ctxt_per_sec > 999.0f && sched->ctxt_per_sec < 1001.0f);
+    CHECK(sched->procs_running == 6.0f && sched->procs_blocked == 0.5f && sched->running_per_cpu == 3.0f);
+    CHECK(sched->psi && sched->some_avg10 == NUM_SAMPLES - 1);
+    CHECK(sched->some_stall > 49.9f && sched->some_stall < 50.1f);
+    CHECK(sched->full_stall > 9.9f && sched->full_stall < 10.1f);
+    free_usage(usage);
+
+    samples = new_test_samples(3); // a pressure file with just the "some" line
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        samples[i].sched.psi        = true;
+        samples[i].sched.some_total = i * 10000;
+    }
+    usage = get_usage(samples);
+    CHECK(usage.sched.psi && usage.sched.some_stall > 9.9f && usage.sched.some_stall < 10.1f);
+    CHECK(usage.sched.full_stall == UNKNOWN_USAGE && usage.sched.full_avg10 == UNKNOWN_USAGE && usage.sched.full_avg60 == UNKNOWN_USAGE);
+    free_usage(usage);
+
+    samples = new_test_samples(3); // no pressure file, and the counters tell nothing without time passing
+    for (size_t i = 0; i < NUM_SAMPLES; ++i)
+        samples[i].timestamp_nanos = 0;
+    usage = get_usage(samples);
+    CHECK(!usage.sched.psi && usage.sched.some_stall == UNKNOWN_USAGE && usage.sched.ctxt_per_sec == UNKNOWN_USAGE);
+    free_usage(usage);
+    return true;
+}
+
+// a file of its own under /tmp, so that concurrent runs don't trip over each other
+static bool new_test_file(char * const path_template) {
+    int fd = mkstemp(path_template);
+    CHECK(fd >= 0 && close(fd) == 0);
+    return true;
+}
+
+static bool write_test_file(const char * const path, const char * const text) {
+    FILE* file = fopen(path, "w");
+    CHECK(file && fputs(text, file) >= 0 && fclose(file) == 0);
+    return true;
+}
+
+// two cpus of four online, then a new interrupt line shows up
+static bool test_irq_counts_and_top_sources() {
+    const char* interrupts =
+        "           CPU0       CPU2       \n"
+        "  1:          9          0   IO-APIC   1-edge      i8042\n"
+        " 24:       1000       5000   PCI-MSI 524288-edge      nvme0q1\n"
+        "LOC:     200000     100000   Local timer interrupts\n"
+        "ERR:          0\n";
+    const char* softirqs =
+        "                    CPU0       CPU2\n"
+        "      NET_RX:        100       9000\n"
+        "       TIMER:      50000        500\n";
+    char interrupts_path[] = "/tmp/cut-interrupts-XXXXXX";
+    char softirqs_path[]   = "/tmp/cut-softirqs-XXXXXX";
+    CHECK(new_test_file(interrupts_path) && new_test_file(softirqs_path));
+    CHECK(write_test_file(interrupts_path, interrupts) && write_test_file(softirqs_path, softirqs));
+    IrqReader* reader = new_irq_reader(interrupts_path, softirqs_path, 4);
+    IrqSnapshot* first = irq_read(reader);
+    CHECK(first && first->layout->num_sources == 5); // ERR isn't per cpu
+    CHECK(strcmp(first->layout->names[1], "24:nvme0q1") == 0 && strcmp(first->layout->names[4], "TIMER") == 0);
+    CHECK(first->counts[0 * 5 + 2] == 200000 && first->counts[2 * 5 + 1] == 5000 && first->counts[2 * 5 + 3] == 9000);
+    CHECK(first->counts[1 * 5 + 2] == 0); // offline
+
+    // the same rows, wider numbers
+    CHECK(write_test_file(interrupts_path,
+        "           CPU0       CPU2       \n"
+        "  1:          9          0   IO-APIC   1-edge      i8042\n"
+        " 24:       1000    4005000   PCI-MSI 524288-edge      nvme0q1\n"
+        "LOC:     201000     101000   Local timer interrupts\n"
+        "ERR:          0\n"));
+    CHECK(write_test_file(softirqs_path,
+        "                    CPU0       CPU2\n"
+        "      NET_RX:        100    2009000\n"
+        "       TIMER:      52000        500\n"));
+    IrqSnapshot* last = irq_read(reader);
+    CHECK(last && last->layout == first->layout && last->counts[2 * 5 + 1] == 4005000);
+
+    CpuDataSample* samples = new_test_samples(5); // a second apart, first to last
+    samples[0].irq               = first;
+    samples[NUM_SAMPLES - 1].irq = last;
+    for (size_t i = 0; i < NUM_SAMPLES; ++i)
+        samples[i].timestamp_nanos = i * 1000000000u / (NUM_SAMPLES - 1);
+    CpuUsage usage = get_usage(samples);
+    CHECK(usage.irq && usage.irq->num_cpus == 4);
+    const IrqRate* top = usage.irq->top + 2 * IRQ_TOP_SOURCES;
+    CHECK(top[0].source == 1 && top[0].rate > 3999000.0f && top[0].rate < 4001000.0f);
+    CHECK(top[1].source == 3 && top[2].source == 2 && top[2].rate > 999.0f && top[2].rate < 1001.0f);
+    top = usage.irq->top + 0 * IRQ_TOP_SOURCES;
+    CHECK(top[0].source == 4 && top[1].source == 2 && top[2].rate == 0); // nothing else moved
+    free_usage(usage);
+
+    CHECK(write_test_file(interrupts_path,
+        "           CPU0       CPU2       \n"
+        "  1:          9          0   IO-APIC   1-edge      i8042\n"
+        " 24:       1000    4005000   PCI-MSI 524288-edge      nvme0q1\n"
+        " 25:          1          1   PCI-MSI 524289-edge      \"nvme0q2\"\n"
+        "LOC:     201000     101000   Local timer interrupts\n"
+        "ERR:          0\n"));
+    IrqSnapshot* changed = irq_read(reader);
+    CHECK(changed && changed->layout->num_sources == 6 && strcmp(changed->layout->names[2], "25:_nvme0q2_") == 0);
+    CHECK(changed->counts[2 * 6 + 4] == 2009000);
+    free_irq_snapshot(changed);
+    destroy_irq_reader(reader);
+    unlink(interrupts_path);
+    unlink(softirqs_path);
+    return true;
+}
+
+static bool test_analyzer_pool_matches_single_thread() {
+    enum { NUM_CPUS = 100 };
+    int node_of[NUM_CPUS], core_of[NUM_CPUS];
+    int node_ids[] = {0, 1, 2};
+    int core_ids[NUM_CPUS / 2];
+    for (int cpu = 0; cpu < NUM_CPUS; ++cpu) {
+        node_of[cpu] = cpu % 3;
+        core_of[cpu] = cpu / 2;
+        core_ids[cpu / 2] = cpu / 2;
+    }
+    CpuTopology topology = {
+        .num_cpus   = NUM_CPUS,
+        .group_of   = {node_of, node_of, core_of, node_of},
+        .group_id   = {node_ids, node_ids, core_ids, node_ids},
+        .num_groups = {3, 3, NUM_CPUS / 2, 3},
+    };
+
+    CpuUsage expected = get_usage(new_test_samples(NUM_CPUS + 1));
+    aggregate_usage(&expected, &topology);
+    AnalyzerPool* pool = new_analyzer_pool(3, &topology, NULL);
+    for (int batch = 0; batch < 3; ++batch) { // the shards pick up every batch, not just the first one
+        CpuUsage usage = pool_analyze(pool, new_test_samples(NUM_CPUS + 1), false);
+        CHECK(usage.length == expected.length);
+        CHECK(usage.window_start_nanos == expected.window_start_nanos && usage.window_end_nanos == expected.window_end_nanos);
+        CHECK(memcmp(usage.usage, expected.usage, usage.length * sizeof(cpu_usage_t)) == 0);
+        CHECK(memcmp(usage.steal, expected.steal, usage.length * sizeof(cpu_usage_t)) == 0);
+        for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+            CHECK(usage.num_groups[level] == expected.num_groups[level]);
+            for (long group = 0; group < usage.num_groups[level]; ++group) { // summed in a different order
+                cpu_usage_t diff = usage.group_usage[level][group] - expected.group_usage[level][group];
+                CHECK(diff < 0.001f && diff > -0.001f);
+            }
+        }
+        free_usage(usage);
+    }
+    destroy_analyzer_pool(pool);
+    free_usage(expected);
+    return true;
+}
+
+static bool test_shm_seqlock_concurrent_readers() {
+    float values[SHM_TEST_CPUS + 1];
+    float groups_data[USAGE_SHM_LEVELS][2];
+    const float* groups[USAGE_SHM_LEVELS];
+    long num_groups[USAGE_SHM_LEVELS];
+    for (size_t level = 0; level < USAGE_SHM_LEVELS; ++level) {
+        groups[level] = groups_data[level];
+        num_groups[level] = 2;
+    }
+
+    UsageShm* shm = usage_shm_create(SHM_TEST_NAME, SIZE(values) + USAGE_SHM_LEVELS * 2);
+    CHECK(shm != NULL);
+
+    atomic_bool done = false;
+    pthread_t readers[SHM_TEST_READERS];
+    shm_reader_arg_t args[SHM_TEST_READERS];
+    for (size_t i = 0; i < SHM_TEST_READERS; ++i) {
+        args[i] = (shm_reader_arg_t){.done = &done, .num_snapshots = 0, .consistent = true};
+        CHECK(pthread_create(readers + i, NULL, shm_reader_routine, args + i) == 0);
+    }
+
+    for (uint64_t seq = 1; seq <= SHM_TEST_PUBLISHES; ++seq) {
+        for (size_t i = 0; i < SIZE(values); ++i)
+            values[i] = (float)seq; // seq is the publish count, exactly representable up to 2^24
+        for (size_t level = 0; level < USAGE_SHM_LEVELS; ++level)
+            groups_data[level][0] = groups_data[level][1] = (float)seq;
+        usage_shm_publish(shm, seq, values, SIZE(values), groups, num_groups);
+    }
+    atomic_store(&done, true);
+
+    bool consistent = true;
+    for (size_t i = 0; i < SHM_TEST_READERS; ++i) {
+        CHECK(pthread_join(readers[i], NULL) == 0);
+        log_info("shm reader #%zu took %zu snapshots", i, args[i].num_snapshots);
+        consistent &= args[i].consistent;
+    }
+    CHECK(consistent);
+
+    // a second writer under the same name gets a segment of its own, smaller or not, and the readers
+    // of the first one keep theirs
+    UsageShm* reader    = usage_shm_open(SHM_TEST_NAME);
+    UsageShm* successor = usage_shm_create(SHM_TEST_NAME, 1);
+    CHECK(reader && successor);
+    UsageSnapshot snapshot;
+    CHECK(usage_shm_snapshot(reader, &snapshot) && snapshot.num_values == SIZE(values) + USAGE_SHM_LEVELS * 2);
+    usage_shm_close(reader);
+    usage_shm_destroy(shm);
+    CHECK((reader = usage_shm_open(SHM_TEST_NAME)) != NULL); // the first writer only unlinks its own segment
+    usage_shm_close(reader);
+    usage_shm_destroy(successor);
+    return true;
+}
+
+#define EXPORTER_TEST_PATH "/tmp/cut-exporter-test.sock"
+
+static bool test_exporter_serves_cached_response() {
+    Exporter* exporter = new_exporter("unix:" EXPORTER_TEST_PATH);
+    cpu_usage_t per_cpu[] = {42.0f, UNKNOWN_USAGE};
+    CpuUsage usage = {.usage = per_cpu, .length = SIZE(per_cpu), .topology = NULL,
+        .window_start_nanos = 1000000000u, .window_end_nanos = 1250000000u};
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        usage.num_groups[level] = 0;
+    usage.sched.psi = true; // whose help line is longer than the body's per-line guess
+    exporter_update(exporter, &usage);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX, .sun_path = EXPORTER_TEST_PATH};
+    CHECK(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    CHECK(write(fd, request, sizeof(request) - 1) == sizeof(request) - 1);
+
+    char response[8192] = {'\0'};
+    size_t pos = 0;
+    ssize_t nread = -1;
+    for (size_t i = 0; i < 10 && nread != 0; ++i) { // accept, read the request, answer, close
+        exporter_poll(exporter, 100);
+        while ((nread = recv(fd, response + pos, sizeof(response) - 1 - pos, MSG_DONTWAIT)) > 0)
+            pos += nread;
+    }
+    close(fd);
+    destroy_exporter(exporter);
+
+    CHECK(strncmp(response, "HTTP/1.0 200 OK", strlen("HTTP/1.0 200 OK")) == 0);
+    CHECK(strstr(response, "cut_cpu_usage_percent{cpu=\"total\"} 42.00\n"));
+    CHECK(strstr(response, "cut_cpu_usage_percent{cpu=\"0\"} NaN\n"));
+    CHECK(strstr(response, "cut_batches_read_total"));
+    CHECK(strstr(response, "\ncut_sampling_window_seconds 0.250\n"));
+    CHECK(strstr(response, "cut_cpu_pressure_percent{kind=\"full\",window=\"avg60\"} 0.00\n"));
+    CHECK(strstr(response, "\ncut_scrapes_expired_total ")); // nothing cut off at the end
+    return true;
+}
+
+static CpuUsage new_test_usage(const cpu_usage_t total) {
+    CpuUsage usage = {.usage = checked_malloc(sizeof(cpu_usage_t)), .length = 1, .topology = NULL};
+    usage.usage[0] = total;
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        usage.group_usage[level] = NULL;
+        usage.num_groups[level]  = 0;
+    }
+    return usage;
+}
+
+static bool test_bus_fan_out_shares_snapshots() {
+    UsageBus bus;
+    bus_init(&bus);
+    WorkerCtx all, latest;
+    init_worker_ctx(&all, sizeof(SharedUsage*));
+    init_worker_ctx(&latest, sizeof(SharedUsage*));
+    Subscriber* sub_all    = bus_subscribe(&bus, "all", &all, 0, false);
+    Subscriber* sub_latest = bus_subscribe(&bus, "latest", &latest, 1, true);
+
+    for (int i = 0; i < 3; ++i)
+        bus_publish(&bus, new_test_usage(i));
+    CHECK(subscriber_lag(&bus, sub_all) == 3);
+    CHECK(subscriber_lag(&bus, sub_latest) == 1);
+    CHECK(sub_latest->dropped == 2);
+
+    // both subscribers see the very same snapshot, not a copy of it
+    SharedUsage* from_all    = *(SharedUsage**)queue_front(&all.job_queue);
+    SharedUsage* from_latest = *(SharedUsage**)queue_front(&latest.job_queue);
+    CHECK(from_all->usage.usage[0] == 0.0f);
+    CHECK(from_latest->usage.usage[0] == 2.0f);
+    queue_pop_front(&latest.job_queue);
+    subscriber_release(sub_latest, from_latest);
+    CHECK(subscriber_lag(&bus, sub_latest) == 0);
+    CHECK(atomic_load(&from_latest->refs) == 1); // still queued for the other subscriber
+
+    bus_destroy(&bus); // releases what's left in the queues
+    destroy_worker_ctx(&all);
+    destroy_worker_ctx(&latest);
+    return true;
+}
+
+static void* sleep_for_long(void* arg) {
+    *(bool*)arg = sleep_unless_shutdown(10000000);
+    return NULL;
+}
+
+static bool test_shutdown_cuts_sleeps_short() {
+    shutdown_init();
+    CHECK(sleep_unless_shutdown(1000) && !shutting_down());
+
+    bool slept = true;
+    pthread_t sleeper;
+    CHECK(pthread_create(&sleeper, NULL, sleep_for_long, &slept) == 0);
+    usleep(20000);
+    const uint64_t requested = monotonic_nanos();
+    request_shutdown();
+    CHECK(pthread_join(sleeper, NULL) == 0);
+    CHECK(!slept && monotonic_nanos() - requested < 1000000000u); // rather than the ten seconds
+    CHECK(!sleep_unless_shutdown(1000000) && shutting_down());
+    shutdown_destroy();
+
+    // a closed bus wakes up its event loops, but whatever is queued stays there to be drained
+    UsageBus bus;
+    bus_init(&bus);
+    WorkerCtx loop;
+    init_worker_ctx(&loop, sizeof(SharedUsage*));
+    Subscriber* sub = bus_subscribe(&bus, "loop", &loop, 0, true);
+    bus_publish(&bus, new_test_usage(1));
+    bus_close(&bus);
+    uint64_t count;
+    CHECK(loop.upstream_done && loop.job_queue.num_items == 1);
+    CHECK(read(sub->notify_fd, &count, sizeof(count)) == sizeof(count) && count == 2);
+    bus_destroy(&bus);
+    destroy_worker_ctx(&loop);
+    return true;
+}
+
+// a connected pair of tcp sockets on 127.0.0.1, the first one to write and the second one to read
+static bool loopback_tcp_pair(int * const fds) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t addr_len = sizeof(addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(listen_fd >= 0 && bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listen_fd, 1) == 0);
+    CHECK(getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == 0);
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fds[0] >= 0 && connect(fds[0], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    fds[1] = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    CHECK(fds[1] >= 0);
+    return true;
+}
+
+static bool test_alert_hysteresis_and_cooldown() {
+    AlertRule rules[2];
+    CHECK(parse_alert_rule("cpu > 90% for 2 s", rules));
+    CHECK(parse_alert_rule("steal>5", rules + 1));
+    CHECK(rules[0].for_millis == 2000 && rules[0].clear_threshold == 81.0f);
+    CHECK(!parse_alert_rule("cpu > 90 for", rules + 1));
+    CHECK(!parse_alert_rule("cpu > 90 clear 95", rules + 1));
+    CHECK(!parse_alert_rule("disk > 90", rules + 1));
+    CHECK(parse_alert_rule("steal > 5", rules + 1));
+
+    int pipe_fds[2];
+    CHECK(pipe(pipe_fds) == 0);
+    CpuTopology topology = {.num_cpus = 1};
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        topology.num_groups[level] = 0;
+    AlertEngine* alerts = new_alert_engine(rules, SIZE(rules), &topology, pipe_fds[1]);
+
+    cpu_usage_t per_cpu[] = {0.0f, 0.0f};
+    CpuUsage usage = {.usage = per_cpu, .steal = NULL, .length = SIZE(per_cpu), .topology = NULL};
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level)
+        usage.num_groups[level] = 0;
+    const struct {
+        int64_t now_millis;
+        cpu_usage_t value;
+        size_t num_events;
+    } ticks[] = {
+        {0, 95, 0}, {1000, 95, 0}, {2000, 95, 1}, // fires once it has held for 2 s
+        {3000, 85, 0},                            // above the clear threshold, still firing
+        {4000, 50, 1},                            // resolved, quiet for 10 s
+        {5000, 95, 0}, {8000, 95, 0}, {14000, 95, 1},
+    };
+    for (size_t i = 0; i < SIZE(ticks); ++i) {
+        per_cpu[1] = ticks[i].value;
+        CHECK(alerts_evaluate(alerts, &usage, ticks[i].now_millis) == ticks[i].num_events);
+    }
+    cpu_usage_t steal[] = {6.0f, 6.0f};
+    usage.steal = steal;
+    CHECK(alerts_evaluate(alerts, &usage, 15000) == 1);
+    destroy_alert_engine(alerts);
+
+    char events[2048] = {'\0'};
+    CHECK(read(pipe_fds[0], events, sizeof(events) - 1) > 0);
+    close(pipe_fds[0]);
+    CHECK(strstr(events, "state=firing target=cpu0 value=95.0 rule=\"cpu > 90% for 2 s\"\n"));
+    CHECK(strstr(events, "state=resolved target=cpu0 value=50.0"));
+    CHECK(strstr(events, "state=firing target=cpu0 value=6.0 rule=\"steal > 5\"\n"));
+
+    // a listener that falls behind gets whole lines, some of them dropped, but never a torn one
+    // over loopback tcp, which unlike a unix socket takes part of a send when it's nearly full
+    int sock_fds[2];
+    CHECK(loopback_tcp_pair(sock_fds));
+    const int bufsize = 1; // as small as the kernel goes
+    CHECK(setsockopt(sock_fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)) == 0);
+    CHECK(setsockopt(sock_fds[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)) == 0);
+    CHECK(fcntl(sock_fds[1], F_SETFL, O_NONBLOCK) == 0);
+    alerts = new_alert_engine(rules, 1, &topology, sock_fds[0]);
+    usage.steal = NULL;
+    const uint64_t lost = stat_get(STAT_ALERT_EVENTS_LOST);
+    size_t emitted = 0;
+    for (int64_t i = 0; i < 1000; ++i) { // firing and resolved in turn, past every cooldown
+        per_cpu[1] = i % 2 ? 50.0f : 95.0f;
+        emitted += alerts_evaluate(alerts, &usage, i * 20000);
+        emitted += alerts_evaluate(alerts, &usage, i * 20000 + 2000); // the rule holds for 2 s
+    }
+    static char received[1 << 17];
+    size_t nreceived = 0;
+    for (size_t round = 0; round < 10; ++round) { // the stuck tail goes out as the listener catches up
+        ssize_t nread;
+        while ((nread = read(sock_fds[1], received + nreceived, sizeof(received) - 1 - nreceived)) > 0)
+            nreceived += nread;
+        alerts_evaluate(alerts, &usage, 1000 * 20000);
+    }
+    destroy_alert_engine(alerts);
+    close(sock_fds[1]);
+    received[nreceived] = '\0';
+    size_t nlines = 0;
+    for (char* line = received; *line; ++nlines) {
+        char* end = strchr(line, '\n');
+        CHECK(end && strncmp(line, "time=", 5) == 0);
+        *end = '\0';
+        CHECK(!strstr(line + 5, "time=")); // nothing glued onto it
+        line = end + 1;
+    }
+    CHECK(stat_get(STAT_ALERT_EVENTS_LOST) > lost && nlines + (stat_get(STAT_ALERT_EVENTS_LOST) - lost) == emitted);
+    return true;
+}
+
+#define CLOCK_TEST_THREADS 4
+#define CLOCK_TEST_ROUNDS  10000
+
+typedef struct {
+    time_t seconds[2];
+    const char* expected[2];
+    bool consistent;
+} clock_test_arg_t;
+
+// two seconds back and forth, so that the threads keep replacing each other's cached prefix
+static void* clock_test_routine(void* arg) {
+    clock_test_arg_t* test = arg;
+    char prefix[WALL_CLOCK_PREFIX_LEN + 1];
+    for (size_t i = 0; i < CLOCK_TEST_ROUNDS; ++i) {
+        wall_clock_prefix(test->seconds[i % 2], prefix);
+        test->consistent &= strcmp(prefix, test->expected[i % 2]) == 0;
+    }
+    return NULL;
+}
+
+static bool test_wall_clock_prefix_shared_by_threads() {
+    char expected[2][WALL_CLOCK_PREFIX_LEN + 1];
+    time_t seconds[2] = {time(NULL), time(NULL) + 3600 + 1};
+    for (size_t i = 0; i < 2; ++i) {
+        struct tm local;
+        CHECK(localtime_r(seconds + i, &local));
+        CHECK(strftime(expected[i], sizeof(expected[i]), "[%Y-%m-%d %H:%M:%S]", &local) == WALL_CLOCK_PREFIX_LEN);
+    }
+
+    pthread_t threads[CLOCK_TEST_THREADS];
+    clock_test_arg_t args[CLOCK_TEST_THREADS];
+    for (size_t i = 0; i < CLOCK_TEST_THREADS; ++i) {
+        args[i] = (clock_test_arg_t){
+            .seconds    = {seconds[i % 2], seconds[(i + 1) % 2]},
+            .expected   = {expected[i % 2], expected[(i + 1) % 2]},
+            .consistent = true,
+        };
+        CHECK(pthread_create(threads + i, NULL, clock_test_routine, args + i) == 0);
+    }
+    for (size_t i = 0; i < CLOCK_TEST_THREADS; ++i) {
+        CHECK(pthread_join(threads[i], NULL) == 0);
+        CHECK(args[i].consistent);
+    }
+    return true;
+}
+
+static bool test_observer_charges_own_time() {
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    cpu_time_t before[num_cpus + 1], after[num_cpus + 1];
+    observer_init(num_cpus);
+    observer_sample(before);
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do { // burn 100 ms worth of cpu, which is 10 ticks at the usual USER_HZ
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec < 100000000L);
+    observer_sample(after);
+    observer_destroy();
+
+    cpu_time_t per_cpu = 0;
+    for (long cpu = 1; cpu <= num_cpus; ++cpu)
+        per_cpu += after[cpu] - before[cpu];
+    // going by the cpu time the thread actually got, however loaded the machine; the kernel rounds
+    // utime and stime to ticks, and splits them between the two by sampling
+    const long burned_ticks = ((now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec)
+        / (1000000000L / sysconf(_SC_CLK_TCK));
+    const long charged   = after[0] - before[0];
+    const long tolerance = 1 + burned_ticks / 10;
+    CHECK(charged >= burned_ticks - tolerance && charged <= burned_ticks + tolerance);
+    CHECK(per_cpu == after[0] - before[0]); // every tick lands on some cpu
+    return true;
+}
+
+static bool test_aggregator_merges_frames() {
+    static Frame frame; // too big to comfortably live on the stack
+    uint8_t buffer[FRAME_MAX_LEN];
+    const float usage_a[] = {50.0f, 20.0f, 80.0f, UNKNOWN_USAGE, 50.0f}; // the total, then four cpus
+    const float usage_b[] = {10.0f, 10.0f};
+
+    size_t length = encode_frame(buffer, "host-a", 7, 123, usage_a, SIZE(usage_a));
+    CHECK(decode_frame(buffer, FRAME_HEADER_LEN - 1, &frame) == FRAME_INCOMPLETE);
+    CHECK(decode_frame(buffer, length - 1, &frame) == FRAME_INCOMPLETE); // it arrives in pieces
+    CHECK(decode_frame(buffer, length, &frame) == (long)length);
+    CHECK(strcmp(frame.host, "host-a") == 0 && frame.seq == 7 && frame.timestamp_nanos == 123);
+    CHECK(frame.num_values == SIZE(usage_a) && frame.values[2] == 80.0f && frame.values[3] < 0);
+
+    Aggregator* aggregator = new_aggregator();
+    aggregator_ingest(aggregator, &frame, 1000);
+    frame.seq = 10; // two frames lost on the way
+    aggregator_ingest(aggregator, &frame, 1100);
+    encode_frame(buffer, "host-b", 0, 456, usage_b, SIZE(usage_b));
+    CHECK(decode_frame(buffer, FRAME_MAX_LEN, &frame) > 0);
+    aggregator_ingest(aggregator, &frame, 1200);
+
+    FleetSummary summary = aggregator_summary(aggregator, 1200);
+    CHECK(summary.hosts == 2 && summary.cpus == 5 && summary.frames == 3 && summary.frames_lost == 2);
+    CHECK(summary.mean_usage == 42.0f); // (4 * 50 + 1 * 10) / 5
+    CHECK(strcmp(summary.busiest_host, "host-a") == 0);
+    summary = aggregator_summary(aggregator, 1100 + HOST_STALE_MILLIS + 1); // host-a has gone quiet
+    CHECK(summary.hosts == 1 && summary.mean_usage == 10.0f);
+    destroy_aggregator(aggregator);
+
+    encode_frame(buffer, "evil\x1b[2J\x01host", 0, 456, usage_b, SIZE(usage_b)); // a terminal escape on the wire
+    CHECK(decode_frame(buffer, FRAME_MAX_LEN, &frame) > 0);
+    CHECK(strcmp(frame.host, "evil?[2J?host") == 0);
+
+    buffer[5] ^= 0xff; // not a frame any more
+    CHECK(decode_frame(buffer, FRAME_MAX_LEN, &frame) == FRAME_INVALID);
+
+    char host[64];
+    CHECK(strcmp(split_host_port("example.org:9463", host, sizeof(host)), "9463") == 0 && strcmp(host, "example.org") == 0);
+    CHECK(strcmp(split_host_port("[::1]:9463", host, sizeof(host)), "9463") == 0 && strcmp(host, "::1") == 0);
+    CHECK(strcmp(split_host_port("9463", host, sizeof(host)), "9463") == 0 && host[0] == '\0');
+    CHECK(unix_socket_path("unix:/run/cut.sock") && !unix_socket_path("9463"));
+    return true;
+}
+
+static bool test_aggregator_caps_and_evicts_hosts() {
+    static Frame frame;
+    const float usage[] = {10.0f, 10.0f};
+    Aggregator* aggregator = new_aggregator();
+    for (int i = 0; i <= MAX_HOSTS; ++i) { // one too many
+        frame.seq        = 0;
+        frame.num_values = SIZE(usage);
+        memcpy(frame.values, usage, sizeof(usage));
+        checked_snprintf(frame.host, sizeof(frame.host), "host-%d", i);
+        aggregator_ingest(aggregator, &frame, i < MAX_HOSTS / 2 ? 0 : HOST_EVICT_MILLIS);
+    }
+    FleetSummary summary = aggregator_summary(aggregator, HOST_EVICT_MILLIS);
+    CHECK(summary.hosts == MAX_HOSTS / 2 && summary.frames == MAX_HOSTS && summary.frames_refused == 1);
+
+    FILE* devnull = fopen("/dev/null", "w");
+    print_fleet(aggregator, devnull, HOST_EVICT_MILLIS); // every host sorted, not just the live ones
+    CHECK(aggregator_evict(aggregator, HOST_EVICT_MILLIS + 1) == MAX_HOSTS / 2);
+    aggregator_ingest(aggregator, &frame, HOST_EVICT_MILLIS + 1); // room for the one refused before
+    summary = aggregator_summary(aggregator, HOST_EVICT_MILLIS + 1);
+    CHECK(summary.hosts == MAX_HOSTS / 2 + 1 && summary.frames_refused == 1);
+    checked_snprintf(frame.host, sizeof(frame.host), "host-%d", MAX_HOSTS - 1);
+    aggregator_ingest(aggregator, &frame, HOST_EVICT_MILLIS + 2); // the survivors are still found after the shuffle
+    summary = aggregator_summary(aggregator, HOST_EVICT_MILLIS + 2);
+    CHECK(summary.hosts == MAX_HOSTS / 2 + 1 && summary.frames == MAX_HOSTS + 2);
+    print_fleet(aggregator, devnull, HOST_EVICT_MILLIS + 2);
+    fclose(devnull);
+    destroy_aggregator(aggregator);
+    return true;
+}
+
+static bool test_log_rate_limit_and_repeats() {
+    static LogSite site;
+    uint64_t suppressed = 0;
+    size_t admitted = 0;
+    for (size_t i = 0; i < 3 * LOG_SITE_BURST; ++i)
+        admitted += log_site_admit(&site, &suppressed);
+    CHECK(admitted == LOG_SITE_BURST);
+    usleep(1000000 / LOG_SITE_RATE + 50000); // a token's worth and some
+    CHECK(log_site_admit(&site, &suppressed));
+    CHECK(suppressed == 2 * LOG_SITE_BURST);
+    CHECK(!log_site_admit(&site, &suppressed));
+
+    uint64_t coalesced = stat_get(STAT_LOGS_COALESCED);
+    for (size_t i = 0; i < 3; ++i)
+        log_info("this should be printed once, then repeated 2 times");
+    CHECK(log_repeats_pending());
+    flush_log_repeats(); // what the logger does after a quiet spell
+    CHECK(!log_repeats_pending());
+    log_info("and this once");
+    CHECK(stat_get(STAT_LOGS_COALESCED) - coalesced == 2);
+    return true;
+}
+
+static bool test_output_formats_and_drops() {
+    static Frame frame;
+    char buffer[256];
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CpuUsage usage = new_usage(3, false); // the total, then two cpus
+    usage.usage[0] = 50.0f;
+    usage.usage[1] = 20.0f;
+    usage.usage[2] = UNKNOWN_USAGE;
+    usage.window_end_nanos   = monotonic_nanos() - 60000000000u; // a minute ago, however late it gets written
+    usage.window_start_nanos = usage.window_end_nanos - 1500000000u;
+    const uint64_t window_end_ms = realtime_of(usage.window_end_nanos) / 1000000;
+
+    Output* output = new_output(dup(fds[1]), FORMAT_CSV, "host");
+    CHECK(output_usage(output, &usage));
+    ssize_t nread = read(fds[0], buffer, sizeof(buffer) - 1);
+    buffer[MAX(nread, 0)] = '\0';
+    CHECK(strncmp(buffer, "time_ms,total,cpu0,cpu1\n", 24) == 0);
+    CHECK(strstr(buffer + 24, ",50.00,20.00,\n") != NULL);
+    CHECK(output_usage(output, &usage)); // no header the second time
+    nread = read(fds[0], buffer, sizeof(buffer) - 1);
+    buffer[MAX(nread, 0)] = '\0';
+    CHECK(strchr(buffer, '\n') == buffer + nread - 1 && strstr(buffer, "time_ms") == NULL);
+    destroy_output(output);
+
+    output = new_output(dup(fds[1]), FORMAT_JSON, "host");
+    CHECK(output_usage(output, &usage));
+    nread = read(fds[0], buffer, sizeof(buffer) - 1);
+    buffer[MAX(nread, 0)] = '\0';
+    CHECK(strncmp(buffer, "{\"time_ms\":", 11) == 0);
+    const uint64_t time_ms = strtoull(buffer + 11, NULL, 10);
+    CHECK(time_ms + 10 >= window_end_ms && time_ms <= window_end_ms + 10);
+    CHECK(strstr(buffer, ",\"window_ms\":1500,") != NULL);
+    CHECK(strstr(buffer, ",\"total\":50.00,\"cpus\":[20.00,null],\"sched\":{") != NULL);
+    destroy_output(output);
+
+    output = new_output(dup(fds[1]), FORMAT_BINARY, "host");
+    CHECK(output_usage(output, &usage));
+    nread = read(fds[0], buffer, sizeof(buffer));
+    CHECK(decode_frame((uint8_t*)buffer, nread, &frame) == nread);
+    CHECK(strcmp(frame.host, "host") == 0 && frame.num_values == 3 && frame.values[1] == 20.0f && frame.values[2] < 0);
+
+    // nobody reads the pipe, so it fills up and the records start to be dropped instead of blocking
+    const uint64_t dropped = stat_get(STAT_RECORDS_DROPPED);
+    size_t nrecords = 0;
+    while (output_usage(output, &usage) && nrecords < 1000000)
+        ++nrecords;
+    CHECK(stat_get(STAT_RECORDS_DROPPED) == dropped + 1);
+    CHECK(!output_wait_flush(output, 10)); // still nobody reading
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    size_t ndrained = 0;
+    do {
+        while ((nread = read(fds[0], buffer, sizeof(buffer))) > 0)
+            ndrained += nread;
+    } while (!output_flush(output)); // the record that was stuck halfway goes out in full once there's room
+    while ((nread = read(fds[0], buffer, sizeof(buffer))) > 0)
+        ndrained += nread;
+    CHECK(ndrained == nrecords * (FRAME_HEADER_LEN + strlen("host") + 2 * 3)); // no torn frames
+    destroy_output(output);
+
+    // a piped stdout is reopened, so the shell's end never turns non-blocking, not even for a while
+    fflush(stdout);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    CHECK(dup2(fds[1], STDOUT_FILENO) == STDOUT_FILENO);
+    output = new_output(open_output(NULL), FORMAT_CSV, "host");
+    CHECK(!(fcntl(STDOUT_FILENO, F_GETFL) & O_NONBLOCK) && (fcntl(output_fd(output), F_GETFL) & O_NONBLOCK));
+    destroy_output(output);
+    CHECK(dup2(saved_stdout, STDOUT_FILENO) == STDOUT_FILENO);
+    close(saved_stdout);
+
+    free_usage(usage);
+    close(fds[0]);
+    close(fds[1]);
+    return true;
+}
 
 // Yes, this is an integration test without unit tests for the underlying functions. 
 // But just how are you going to test whether get_samples returns somethign of sense? 
@@ -108,7 +1025,11 @@ static bool test_get_samples_get_data_print_data() {
 #ifdef __linux__
     CpuDataSample* samples = get_samples();
     CpuUsage usage = get_usage(samples);
-    print_usage(usage);
+    CpuTopology* topology = get_topology();
+    aggregate_usage(&usage, topology);
+    print_usage(&usage);
+    free_usage(usage);
+    free_topology(topology);
 #endif /* __linux__ */
     return true;
 }
@@ -116,11 +1037,39 @@ static bool test_get_samples_get_data_print_data() {
 static const test_t tests[] = {
     TEST(test_queue_small_items_push_then_pop),
     TEST(test_queue_big_items_push_then_pop),
+    TEST(test_queue_pushes_and_pops_intertwined),
+    TEST(test_aggregate_usage_by_topology),
+    TEST(test_usage_over_partial_window),
+    TEST(test_usage_weighted_by_interval),
+    TEST(test_adaptive_rate_jumps_holds_and_backs_off),
+    TEST(test_first_batch_from_two_samples),
+    TEST(test_sched_usage_from_counters),
+    TEST(test_irq_counts_and_top_sources),
+    TEST(test_analyzer_pool_matches_single_thread),
+    TEST(test_shm_seqlock_concurrent_readers),
+    TEST(test_exporter_serves_cached_response),
+    TEST(test_bus_fan_out_shares_snapshots),
+    TEST(test_shutdown_cuts_sleeps_short),
+    TEST(test_alert_hysteresis_and_cooldown),
+    TEST(test_observer_charges_own_time),
+    TEST(test_aggregator_merges_frames),
+    TEST(test_aggregator_caps_and_evicts_hosts),
+    TEST(test_log_rate_limit_and_repeats),
+    TEST(test_wall_clock_prefix_shared_by_threads),
+    TEST(test_output_formats_and_drops),
     TEST(test_get_samples_get_data_print_data),
 };
 
 int main(void) {
     logger_init(false);
+    ReaderConfig reader_config = {
+        .observe_self    = false,
+        .adaptive        = false,
+        .interval_micros = 0,
+        .synthetic_cpus  = 0,
+        .irqs            = false,
+    };
+    reader_init(&reader_config);
 
     bool OK = true;
     for (size_t i = 0; i < SIZE(tests); ++i) {
@@ -137,6 +1086,7 @@ int main(void) {
     else
         log_error("Tests failed");
 
+    reader_destroy();
     logger_destroy();
     return !OK;
 }
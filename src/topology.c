@@ -0,0 +1,142 @@
+#include "topology.h"
+
+#include "err.h"
+#include "mem.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYSFS_CPU_DIR  "/sys/devices/system/cpu"
+#define SYSFS_NODE_DIR "/sys/devices/system/node"
+#define SYSFS_PATH_LEN 256
+#define SYSFS_LINE_LEN 4096
+#define MAX_CACHE_IDX  16
+#define UNKNOWN_GROUP  (-1)
+
+const char * const topo_level_names[NUM_TOPO_LEVELS] = {
+    "node",
+    "socket",
+    "core",
+    "llc",
+};
+
+// also good for cpu lists - they're sorted, so the leading number is the lowest cpu
+static int read_int(const char * const path) {
+    char buffer[SYSFS_LINE_LEN];
+    if (!read_small_file(path, buffer, sizeof(buffer)))
+        return UNKNOWN_GROUP;
+    return atoi(buffer);
+}
+
+static void read_node_keys(int * const keys, const long num_cpus) {
+    for (long cpu = 0; cpu < num_cpus; ++cpu)
+        keys[cpu] = 0; // no NUMA support compiled in means one node
+
+    DIR* dir = opendir(SYSFS_NODE_DIR);
+    if (!dir)
+        return;
+
+    bool* mask = checked_malloc(num_cpus * sizeof(bool));
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        int node;
+        if (sscanf(entry->d_name, "node%d", &node) != 1)
+            continue;
+        char path[SYSFS_PATH_LEN];
+        char buffer[SYSFS_LINE_LEN];
+        checked_snprintf(path, sizeof(path), SYSFS_NODE_DIR "/node%d/cpulist", node);
+        if (!read_small_file(path, buffer, sizeof(buffer)))
+            continue;
+        parse_cpu_list(buffer, mask, num_cpus);
+        for (long cpu = 0; cpu < num_cpus; ++cpu)
+            if (mask[cpu])
+                keys[cpu] = node;
+    }
+    free(mask);
+    closedir(dir);
+}
+
+static int read_llc_key(const long cpu) {
+    int best_level = 0, key = UNKNOWN_GROUP;
+    for (int idx = 0; idx < MAX_CACHE_IDX; ++idx) {
+        char path[SYSFS_PATH_LEN];
+        checked_snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%ld/cache/index%d/level", cpu, idx);
+        int level = read_int(path);
+        if (level == UNKNOWN_GROUP)
+            break;
+        if (level <= best_level)
+            continue;
+        checked_snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%ld/cache/index%d/shared_cpu_list", cpu, idx);
+        best_level = level;
+        key = read_int(path);
+    }
+    return key;
+}
+
+// maps sparse kernel ids onto 0..n-1, so that aggregation can index plain arrays
+static void densify(CpuTopology * const topology, const topo_level_t level, const int * const keys) {
+    const long num_cpus = topology->num_cpus;
+    int* group_of = checked_malloc(num_cpus * sizeof(int));
+    int* group_id = checked_malloc(num_cpus * sizeof(int));
+    long num_groups = 0;
+
+    for (long cpu = 0; cpu < num_cpus; ++cpu) {
+        group_of[cpu] = UNKNOWN_GROUP;
+        if (keys[cpu] == UNKNOWN_GROUP)
+            continue;
+        long group = 0;
+        while (group < num_groups && group_id[group] != keys[cpu])
+            group++;
+        if (group == num_groups)
+            group_id[num_groups++] = keys[cpu];
+        group_of[cpu] = group;
+    }
+
+    topology->group_of[level]   = group_of;
+    topology->group_id[level]   = group_id;
+    topology->num_groups[level] = num_groups;
+}
+
+CpuTopology* get_topology() {
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (num_cpus < 0)
+        fatal("sysconf");
+
+    CpuTopology* topology = checked_malloc(sizeof(*topology));
+    topology->num_cpus = num_cpus;
+
+    int* keys = checked_malloc(num_cpus * sizeof(int));
+    read_node_keys(keys, num_cpus);
+    densify(topology, TOPO_NODE, keys);
+
+    char path[SYSFS_PATH_LEN];
+    for (long cpu = 0; cpu < num_cpus; ++cpu) {
+        checked_snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%ld/topology/physical_package_id", cpu);
+        keys[cpu] = read_int(path);
+    }
+    densify(topology, TOPO_SOCKET, keys);
+
+    for (long cpu = 0; cpu < num_cpus; ++cpu) {
+        checked_snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%ld/topology/thread_siblings_list", cpu);
+        keys[cpu] = read_int(path);
+    }
+    densify(topology, TOPO_CORE, keys);
+
+    for (long cpu = 0; cpu < num_cpus; ++cpu)
+        keys[cpu] = read_llc_key(cpu);
+    densify(topology, TOPO_LLC, keys);
+
+    free(keys);
+    return topology; // don't forget to free!
+}
+
+void free_topology(CpuTopology * const topology) {
+    for (size_t level = 0; level < NUM_TOPO_LEVELS; ++level) {
+        free(topology->group_of[level]);
+        free(topology->group_id[level]);
+    }
+    free(topology);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+typedef enum {
+    TOPO_NODE,
+    TOPO_SOCKET,
+    TOPO_CORE, // SMT siblings merged
+    TOPO_LLC,
+    NUM_TOPO_LEVELS
+} topo_level_t;
+
+typedef struct {
+    long num_cpus;
+    int* group_of[NUM_TOPO_LEVELS]; // cpu -> dense group index, -1 if the cpu is unknown
+    int* group_id[NUM_TOPO_LEVELS]; // dense group index -> kernel id (for cores and LLCs: their lowest cpu)
+    long num_groups[NUM_TOPO_LEVELS];
+} CpuTopology;
+
+extern const char * const topo_level_names[NUM_TOPO_LEVELS];
+
+CpuTopology* get_topology();
+void free_topology(CpuTopology * const topology);
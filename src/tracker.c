@@ -1,16 +1,35 @@
 #include "mem.h"
 #include "util.h"
 #include "queue.h"
+#include "worker.h"
+#include "bus.h"
 #include "reader.h"
 #include "analyzer.h"
-#include "printer.h"
+#include "topology.h"
+#include "options.h"
+#include "shm.h"
+#include "stages.h"
+#include "analyzer_pool.h"
+#include "reactor.h"
+#include "stats.h"
+#include "exporter.h"
+#include "alert.h"
+#include "forwarder.h"
+#include "frame.h"
+#include "tuning.h"
+#include "output.h"
 #include "logger.h"
+#include "watchdog.h"
+#include "shutdown.h"
 #include "pthread_util.h"
 
 #include <assert.h>
 #include <signal.h>
 #include <unistd.h>
 #include <stdatomic.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
 
 #define READER                  0
 #define ANALYZER                1
@@ -18,42 +37,25 @@
 #define LOGGER                  3
 #define WATCHDOG                4
 #define NUM_WORKERS             4
-#define WATCHDOG_TIMEOUT_MICROS 2000000
-#define PING_ATTEMPTS           4
-#define LOCKING_TIMEOUT_NANOS   ((WATCHDOG_TIMEOUT_MICROS / 1000) / PING_ATTEMPTS) 
-
-#define ATOMIC_PUSH_BACK(worker, worker_id, watchdog, item)            \
-do {                                                                   \
-    lock_and_ping(&worker->mtx, watchdog, worker_id);                  \
-    queue_push_back(&worker->job_queue, item);                         \
-    worker->wait = false;                                              \
-    cnd_signal(&worker->cnd);                                          \
-    mtx_unlock(&worker->mtx);                                          \
-} while(0)
-
-#define ORDER_TERMINATION(worker)                                      \
-do {                                                                   \
-    mtx_lock(&worker->mtx);                                            \
-    worker->wait = false;                                              \
-    cnd_signal(&worker->cnd);                                          \
-    mtx_unlock(&worker->mtx);                                          \
-} while(0)
+#define WATCHDOG_PERIOD_MICROS  250000
+#define DEFAULT_DEADLINE_MILLIS 2000
+#define OUTPUT_RETRY_MILLIS     100 // how often the printer looks for a new record while one is stuck
 
+// every call site has a rate limit of its own, and nothing is formatted or allocated beyond it
 #define ASYNC_LOG(level, worker_id, watchdog, logger, ...)             \
 do {                                                                   \
+    static LogSite site;                                               \
+    uint64_t suppressed;                                               \
+    if (!log_site_admit(&site, &suppressed))                           \
+        break;                                                         \
     LogMsg* msg = new_log_msg(level, __FILE__, __LINE__, __VA_ARGS__); \
-    ATOMIC_PUSH_BACK(logger, worker_id, watchdog, &msg);               \
+    msg->suppressed = suppressed;                                      \
+    worker_push_back(logger, &msg);                                    \
+    heartbeat(watchdog, worker_id);                                    \
 } while(0)
 
-typedef struct { 
-    Queue job_queue;
-    bool wait;
-    pthread_mutex_t mtx;
-    pthread_cond_t cnd;
-} WorkerCtx;
-
 typedef struct {
-    _Atomic bool alive[NUM_WORKERS];
+    Heartbeat workers[NUM_WORKERS];
     WorkerCtx* logger;
 } WatchdogCtx;
 
@@ -61,12 +63,21 @@ typedef struct {
     WorkerCtx self;
     WatchdogCtx* watchdog;
     WorkerCtx* logger;
-    WorkerCtx* next;
+    UsageBus* bus;            // where the analyzer publishes
+    Subscriber* subscription; // where a consumer of the analyzer gets its usage from
+    const Analysis* analysis;
+    Output* output;
+    Exporter* exporter;
+    AlertEngine* alerts;
+    Forwarder* forwarder;
 } SharedWorkerCtx;
 
 typedef SharedWorkerCtx PrinterCtx;
 typedef SharedWorkerCtx AnalyzerCtx;
 typedef SharedWorkerCtx LoggerCtx;
+typedef SharedWorkerCtx ExporterCtx;
+typedef SharedWorkerCtx AlerterCtx;
+typedef SharedWorkerCtx ForwarderCtx;
 
 static const char * const worker_names[] = {
     "Reader",
@@ -75,40 +86,55 @@ static const char * const worker_names[] = {
     "Logger",
 };
 
-volatile sig_atomic_t running = true;
-
+// only async-signal-safe calls in here, so a constant string goes straight to the fd rather than through stdio
 static void sigterm_handler(int signum) {
-    assert(signum == SIGTERM);
-    fprintf(stderr, "Received SIGTERM. Shutting down...\n");
-    running = false;
+    static const char sigterm_msg[] = "Received SIGTERM. Shutting down...\n";
+    static const char sigint_msg[]  = "Received SIGINT. Shutting down...\n";
+    const int saved_errno = errno;
+    const ssize_t written = signum == SIGTERM
+        ? write(STDERR_FILENO, sigterm_msg, sizeof(sigterm_msg) - 1)
+        : write(STDERR_FILENO, sigint_msg, sizeof(sigint_msg) - 1);
+    (void)written; // nothing to be done about a lost message here
+    errno = saved_errno;
+    request_shutdown();
 }
 
-static void init_worker_ctx(WorkerCtx * const ctx, const size_t queue_item_size) {
-    queue_init(&ctx->job_queue, queue_item_size);
-    mtx_init(&ctx->mtx);
-    cnd_init(&ctx->cnd);
-    ctx->wait = true;
-}
-
-static void destroy_worker_ctx(WorkerCtx * const ctx) {
-    queue_destroy(&ctx->job_queue);
-    mtx_destroy(&ctx->mtx);
-    cnd_destroy(&ctx->cnd);
-}
-
-static SharedWorkerCtx* new_shared_worker_ctx(const size_t queue_item_size, WatchdogCtx * const watchdog, WorkerCtx * const logger, WorkerCtx * const next) {
+static SharedWorkerCtx* new_shared_worker_ctx(const size_t queue_item_size, WatchdogCtx * const watchdog, WorkerCtx * const logger) {
     SharedWorkerCtx* ctx = checked_malloc(sizeof(*ctx));
     init_worker_ctx(&ctx->self, queue_item_size);
     ctx->watchdog = watchdog;
     ctx->watchdog->logger = ctx->logger = logger;
-    ctx->next = next;
+    ctx->bus = NULL;
+    ctx->subscription = NULL;
+    ctx->analysis = NULL;
+    ctx->output = NULL;
+    ctx->exporter = NULL;
+    ctx->alerts = NULL;
+    ctx->forwarder = NULL;
     return ctx;
 }
 
-static WatchdogCtx* new_watchdog_ctx() {
+static long deadline_for(const Options * const options, const size_t worker_id) {
+    for (size_t i = 0; i < options->num_deadlines; ++i)
+        if (strcasecmp(options->deadlines[i].worker, worker_names[worker_id]) == 0)
+            return options->deadlines[i].millis;
+    return DEFAULT_DEADLINE_MILLIS;
+}
+
+static WatchdogCtx* new_watchdog_ctx(const Options * const options) {
+    for (size_t i = 0; i < options->num_deadlines; ++i) {
+        bool known = false;
+        for (size_t id = 0; id < NUM_WORKERS; ++id)
+            known |= strcasecmp(options->deadlines[i].worker, worker_names[id]) == 0;
+        if (!known) {
+            errno = 0; // not a system error
+            vfatal("no such worker: %s", options->deadlines[i].worker);
+        }
+    }
+
     WatchdogCtx* ctx = checked_malloc(sizeof(*ctx));
     for (size_t i = 0; i < NUM_WORKERS; ++i)
-        atomic_init(ctx->alive + i, false);
+        heartbeat_init(ctx->workers + i, deadline_for(options, i));
     return ctx;
 }
 
@@ -122,12 +148,8 @@ static void destroy_analyzer_ctx(AnalyzerCtx * const ctx) {
     free(ctx);
 }
 
-static void destroy_printer_ctx(PrinterCtx * const ctx) {
-    while (!queue_empty(&ctx->self.job_queue)) {
-        CpuUsage usage = *(CpuUsage*)queue_front(&ctx->self.job_queue);
-        free_usage(usage);
-        queue_pop_front(&ctx->self.job_queue);
-    }
+// the bus has already released whatever the subscriber didn't get to
+static void destroy_subscriber_ctx(SharedWorkerCtx * const ctx) {
     destroy_worker_ctx(&ctx->self);
     free(ctx);
 }
@@ -146,32 +168,31 @@ static void destroy_watchdog_ctx(WatchdogCtx * const ctx) {
     free(ctx);
 }
 
-static bool should_continue_work(WorkerCtx * const self) {
-    if (queue_empty(&self->job_queue))
-        self->wait = true;
-    while (running && self->wait == true)
-        cnd_wait(&self->cnd, &self->mtx);
-    if (!running) {
-        mtx_unlock(&self->mtx);
-        return false;
-    }
-    return true;
-}
-
-static void ping_watchdog(WatchdogCtx * const watchdog, const size_t worker_id) {
-    atomic_store(watchdog->alive + worker_id, true);
+static void heartbeat(WatchdogCtx * const watchdog, const size_t worker_id) {
+    heartbeat_beat(watchdog->workers + worker_id);
 }
 
-static void mark_for_death(WatchdogCtx * const watchdog, const size_t worker_id) {
-    atomic_store(watchdog->alive + worker_id, false);
+// sampled here rather than with get_samples, so that a slow adaptive rate still shows some progress;
+// false if it's time to stop before the batch is complete
+static bool read_batch(CpuDataSample * const samples, WatchdogCtx * const watchdog) {
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        heartbeat(watchdog, READER);
+        if (!sleep_unless_shutdown(sampling_interval_micros()))
+            return false;
+        read_sample(samples, i);
+    }
+    return true;
 }
 
-static void lock_and_ping(pthread_mutex_t * const mtx, WatchdogCtx * const watchdog, const size_t worker_id) {
-    // doing timed_lock instead of lock in order not to perish accidentally 
-    // because of being hanged on a mutex/condition
-    do {
-        ping_watchdog(watchdog, worker_id);
-    } while (!mtx_timed_lock(mtx, LOCKING_TIMEOUT_NANOS));
+// just two samples in quick succession, so that the first usage shows up right after startup
+static bool read_first_batch(CpuDataSample * const samples, WatchdogCtx * const watchdog) {
+    heartbeat(watchdog, READER);
+    read_sample(samples, 0);
+    if (!sleep_unless_shutdown(MIN(FIRST_BATCH_MICROS, sampling_interval_micros())))
+        return false;
+    read_sample(samples, NUM_SAMPLES - 1);
+    fill_first_batch(samples);
+    return true;
 }
 
 static void* reader_work(void* arg) {
@@ -179,16 +200,31 @@ static void* reader_work(void* arg) {
     WorkerCtx* logger     = ((AnalyzerCtx*)arg)->logger;
     WorkerCtx* analyzer   = &((AnalyzerCtx*)arg)->self;
     ASYNC_LOG(LOG_INFO, READER, watchdog, logger, "[Reader] starting work!");
+    unsigned long generation = 0;
+    long interval_micros     = sampling_interval_micros();
 
-    while (running) {
-        ping_watchdog(watchdog, READER);
-        CpuDataSample* samples = get_samples();
+    for (bool first = true; !shutting_down(); first = false) {
+        CpuDataSample* samples = new_samples();
+        if (!(first ? read_first_batch(samples, watchdog) : read_batch(samples, watchdog))) {
+            free_samples(samples); // a partial batch isn't worth analyzing
+            break;
+        }
+        stat_inc(STAT_BATCHES_READ);
         ASYNC_LOG(LOG_INFO, READER, watchdog, logger, "[Reader] got new samples!");
-        ATOMIC_PUSH_BACK(analyzer, READER, watchdog, &samples);
+        if (samples[NUM_SAMPLES - 1].generation != generation) {
+            generation = samples[NUM_SAMPLES - 1].generation;
+            ASYNC_LOG(LOG_WARN, READER, watchdog, logger, "[Reader] the set of online cpus has changed");
+        }
+        if (sampling_interval_micros() != interval_micros) {
+            interval_micros = sampling_interval_micros();
+            ASYNC_LOG(LOG_INFO, READER, watchdog, logger, "[Reader] sampling every %ld ms now", interval_micros / 1000);
+        }
+        worker_push_back(analyzer, &samples);
+        heartbeat(watchdog, READER);
     }
 
-    ORDER_TERMINATION(analyzer);
     ASYNC_LOG(LOG_WARN, READER, watchdog, logger, "[Reader] shutting down...");
+    order_termination(analyzer); // the batches already read still get analyzed
     return NULL;
 }
 
@@ -196,138 +232,349 @@ static void* analyzer_work(void* arg) {
     WorkerCtx* self       = &((AnalyzerCtx*)arg)->self;
     WatchdogCtx* watchdog = ((AnalyzerCtx*)arg)->watchdog;
     WorkerCtx* logger     = ((AnalyzerCtx*)arg)->logger;
-    WorkerCtx* printer    = ((AnalyzerCtx*)arg)->next;
+    UsageBus* bus         = ((AnalyzerCtx*)arg)->bus;
+    const Analysis* analysis = ((AnalyzerCtx*)arg)->analysis;
     ASYNC_LOG(LOG_INFO, ANALYZER, watchdog, logger, "[Analyzer] starting work!");
 
-    while (running) {
-        lock_and_ping(&self->mtx, watchdog, ANALYZER);
-        if (!should_continue_work(self))
+    while (true) {
+        mtx_lock(&self->mtx);
+        if (!should_continue_work(self, watchdog->workers + ANALYZER))
             break;
-        ASYNC_LOG(LOG_INFO, ANALYZER, watchdog, logger, "[Analyzer] woke up, resuming work");
         assert(!queue_empty(&self->job_queue));
         CpuDataSample* samples = *(CpuDataSample**)queue_front(&self->job_queue);
         queue_pop_front(&self->job_queue);
         mtx_unlock(&self->mtx);
 
-        CpuUsage usage = get_usage(samples);
+        CpuUsage usage = analyze_stage(analysis, samples);
         ASYNC_LOG(LOG_INFO, ANALYZER, watchdog, logger, "[Analyzer] gathered new usage info");
-        ATOMIC_PUSH_BACK(printer, ANALYZER, watchdog, &usage);
+        bus_publish(bus, usage); // the subscribers own it from now on
     }
 
-    ORDER_TERMINATION(printer);
     ASYNC_LOG(LOG_WARN, ANALYZER, watchdog, logger, "[Analyzer] shutting down...");
+    bus_close(bus);
     return NULL;
 }
 
+// the rest of a record that didn't fit goes out as soon as the reader makes room for it, rather than
+// with the next record - which is looked for every so often meanwhile
+static void flush_while_idle(WorkerCtx * const self, Heartbeat * const hb, Output * const output) {
+    atomic_store(&hb->waiting, true);
+    while (!output_wait_flush(output, OUTPUT_RETRY_MILLIS)) {
+        mtx_lock(&self->mtx);
+        const bool idle = queue_empty(&self->job_queue) && !self->upstream_done;
+        mtx_unlock(&self->mtx);
+        if (!idle)
+            break;
+    }
+    atomic_store(&hb->waiting, false);
+}
+
 static void* printer_work(void* arg) {
     WorkerCtx* self       = &((PrinterCtx*)arg)->self;
     WatchdogCtx* watchdog = ((PrinterCtx*)arg)->watchdog;
     WorkerCtx* logger     = ((PrinterCtx*)arg)->logger;
+    Subscriber* sub       = ((PrinterCtx*)arg)->subscription;
+    Output* output        = ((PrinterCtx*)arg)->output;
     ASYNC_LOG(LOG_INFO, PRINTER, watchdog, logger, "[Printer] starting work!");
 
-    while (running) {
-        lock_and_ping(&self->mtx, watchdog, PRINTER);
-        if (!should_continue_work(self))
+    while (true) {
+        mtx_lock(&self->mtx);
+        if (!should_continue_work(self, watchdog->workers + PRINTER))
             break;
-        ASYNC_LOG(LOG_INFO, PRINTER, watchdog, logger, "[Printer] woke up, resuming work");
         assert(!queue_empty(&self->job_queue));
-        CpuUsage usage = *(CpuUsage*)queue_front(&self->job_queue);
+        SharedUsage* shared = *(SharedUsage**)queue_front(&self->job_queue);
         queue_pop_front(&self->job_queue);
         mtx_unlock(&self->mtx);
-        print_usage(usage);
-        ASYNC_LOG(LOG_INFO, PRINTER, watchdog, logger, "[Printer] printed usage info");
+        const bool printed = output_usage(output, &shared->usage);
+        subscriber_release(sub, shared);
+        if (printed) {
+            stat_inc(STAT_USAGES_PRINTED);
+            ASYNC_LOG(LOG_INFO, PRINTER, watchdog, logger, "[Printer] printed usage info");
+        } else {
+            ASYNC_LOG(LOG_WARN, PRINTER, watchdog, logger, "[Printer] dropped usage info, the output is backed up");
+        }
+        flush_while_idle(self, watchdog->workers + PRINTER, output);
     }
 
     ASYNC_LOG(LOG_WARN, PRINTER, watchdog, logger, "[Printer] shutting down...");
-    ORDER_TERMINATION(logger); // let the printer do this as the last worker in the chain
+    order_termination(logger); // let the printer do this as the last worker in the chain
     return NULL;
 }
 
-// yes, the workers' logs are not perfect (they're kinda noisy/spammy)
-// but it's for a good reason - 
-// for the logger to not be accidentally marked as dead,
-// the other workers need to keep giving him work to do
 static void* logger_work(void* arg) {
     WorkerCtx* self       = &((LoggerCtx*)arg)->self;
     WatchdogCtx* watchdog = ((LoggerCtx*)arg)->watchdog;
     log_info("[Logger] starting work!");
 
-    while (running) {
-        lock_and_ping(&self->mtx, watchdog, LOGGER);
-        if (!should_continue_work(self))
+    while (true) {
+        const bool repeats_pending = log_repeats_pending();
+        mtx_lock(&self->mtx);
+        if (repeats_pending && !wait_for_work(self, watchdog->workers + LOGGER, LOG_REPEAT_FLUSH_MILLIS)) {
+            mtx_unlock(&self->mtx);
+            flush_log_repeats(); // a repeated message shouldn't go unreported through a quiet spell
+            continue;
+        }
+        if (!should_continue_work(self, watchdog->workers + LOGGER))
             break;
-        log_info("[Logger] woke up, resuming work"); // disregard the queue's order
         assert(!queue_empty(&self->job_queue));
         LogMsg* msg = *(LogMsg**)queue_front(&self->job_queue);
         queue_pop_front(&self->job_queue);
         mtx_unlock(&self->mtx);
 
         print_log_msg(msg);
+        stat_inc(STAT_LOGS_WRITTEN);
     }
 
+    flush_log_repeats();
     log_warn("[Logger] shutting down...");
     return NULL;
 }
 
+// not part of the watched pipeline - a scraper can only ever slow down this thread
+static void* exporter_work(void* arg) {
+    WorkerCtx* self    = &((ExporterCtx*)arg)->self;
+    Exporter* exporter = ((ExporterCtx*)arg)->exporter;
+    Subscriber* sub    = ((ExporterCtx*)arg)->subscription;
+    exporter_add_wakeup_fd(exporter, sub->notify_fd); // also fired once the analyzer is done
+
+    bool done = false;
+    while (!done) {
+        if (!exporter_poll(exporter, -1))
+            continue;
+        SharedUsage* latest = NULL; // only the newest usage is worth rendering
+        mtx_lock(&self->mtx);
+        while (!queue_empty(&self->job_queue)) {
+            if (latest)
+                subscriber_release(sub, latest);
+            latest = *(SharedUsage**)queue_front(&self->job_queue);
+            queue_pop_front(&self->job_queue);
+        }
+        done = self->upstream_done;
+        mtx_unlock(&self->mtx);
+        if (latest) {
+            exporter_update(exporter, &latest->usage); // rendered once, however many scrapes follow
+            subscriber_release(sub, latest);
+        }
+    }
+    return NULL;
+}
+
+// for the unwatched subscribers, NULL once the analyzer is done and the queue is drained
+static SharedUsage* next_shared_usage(WorkerCtx * const self) {
+    mtx_lock(&self->mtx);
+    if (!should_continue_work(self, NULL))
+        return NULL;
+    SharedUsage* shared = *(SharedUsage**)queue_front(&self->job_queue);
+    queue_pop_front(&self->job_queue);
+    mtx_unlock(&self->mtx);
+    return shared;
+}
+
+// not watched either, it sees every snapshot but only ever slows down its own queue
+static void* alerter_work(void* arg) {
+    WorkerCtx* self     = &((AlerterCtx*)arg)->self;
+    AlertEngine* alerts = ((AlerterCtx*)arg)->alerts;
+    Subscriber* sub     = ((AlerterCtx*)arg)->subscription;
+
+    SharedUsage* shared;
+    while ((shared = next_shared_usage(self))) {
+        alerts_evaluate(alerts, &shared->usage, shared->usage.window_end_nanos / 1000000); // however long it queued
+        subscriber_release(sub, shared);
+    }
+    return NULL;
+}
+
+// the same goes for a slow or missing aggregator
+static void* forwarder_work(void* arg) {
+    WorkerCtx* self      = &((ForwarderCtx*)arg)->self;
+    Forwarder* forwarder = ((ForwarderCtx*)arg)->forwarder;
+    Subscriber* sub      = ((ForwarderCtx*)arg)->subscription;
+
+    SharedUsage* shared;
+    while ((shared = next_shared_usage(self))) {
+        forward_usage(forwarder, &shared->usage);
+        subscriber_release(sub, shared);
+    }
+    return NULL;
+}
+
 // not using the logger here to avoid any data races
 // and a dependency upon a possibly dead worker (thus a dedadlock)
 static void* watchdog_work(void* arg) {
     WatchdogCtx* self = (WatchdogCtx*)arg;
 
-    while (running) {
-        usleep(WATCHDOG_TIMEOUT_MICROS);
-        for (size_t i = 0; i < NUM_WORKERS; ++i) {
-            if (running && !atomic_load(self->alive + i)) {
-                checked_fprintf(stderr, "[Watchdog] worker #%zu (%s) died!\n", i, worker_names[i]);
-                exit(EXIT_FAILURE);
-            }
-            mark_for_death(self, i);
-        }
-        checked_fprintf(stderr, "[Watchdog] all workers are alive\n");
+    while (sleep_unless_shutdown(WATCHDOG_PERIOD_MICROS)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (size_t i = 0; !shutting_down() && i < NUM_WORKERS; ++i)
+            check_heartbeat(self->workers + i, worker_names[i], &now);
     }
 
     checked_fprintf(stderr, "[Watchdog] shutting down...\n");
     return NULL;
 }
 
-int main(void) {
-#ifndef __linux__
-    fatal("CUT (CPU Usage Tracker) only works on Linux!");
-#else
-    logger_init(true);
-
+static void run_threads(const Options * const options, const Analysis * const analysis, Output * const output,
+    AlertEngine * const alerts, Forwarder * const forwarder) {
+    shutdown_init();
     struct sigaction sa;
     sa.sa_handler = sigterm_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
     sigaction(SIGTERM, &sa, NULL);
-
-    WatchdogCtx* watchdog_ctx = new_watchdog_ctx();
-    LoggerCtx* logger_ctx     = new_shared_worker_ctx(sizeof(LogMsg*), watchdog_ctx, NULL, NULL);
-    PrinterCtx* printer_ctx   = new_shared_worker_ctx(sizeof(CpuUsage), watchdog_ctx, &logger_ctx->self, NULL);
-    AnalyzerCtx* analyzer_ctx = new_shared_worker_ctx(sizeof(CpuDataSample*), watchdog_ctx, &logger_ctx->self, &printer_ctx->self);
+    sigaction(SIGINT, &sa, NULL);
+
+    WatchdogCtx* watchdog_ctx = new_watchdog_ctx(options);
+    LoggerCtx* logger_ctx     = new_shared_worker_ctx(sizeof(LogMsg*), watchdog_ctx, NULL);
+    PrinterCtx* printer_ctx   = new_shared_worker_ctx(sizeof(SharedUsage*), watchdog_ctx, &logger_ctx->self);
+    AnalyzerCtx* analyzer_ctx = new_shared_worker_ctx(sizeof(CpuDataSample*), watchdog_ctx, &logger_ctx->self);
+    analyzer_ctx->analysis    = analysis;
+    printer_ctx->output       = output;
+
+    UsageBus bus;
+    bus_init(&bus);
+    analyzer_ctx->bus = &bus;
+    printer_ctx->subscription = bus_subscribe(&bus, "Printer", &printer_ctx->self, 0, false);
+    ExporterCtx* exporter_ctx = NULL;
+    if (options->exporter_addr) {
+        exporter_ctx = new_shared_worker_ctx(sizeof(SharedUsage*), watchdog_ctx, &logger_ctx->self);
+        exporter_ctx->exporter     = new_exporter(options->exporter_addr);
+        exporter_ctx->subscription = bus_subscribe(&bus, "Exporter", &exporter_ctx->self, 1, true);
+    }
+    AlerterCtx* alerter_ctx = NULL;
+    if (alerts) {
+        alerter_ctx = new_shared_worker_ctx(sizeof(SharedUsage*), watchdog_ctx, &logger_ctx->self);
+        alerter_ctx->alerts       = alerts;
+        alerter_ctx->subscription = bus_subscribe(&bus, "Alerter", &alerter_ctx->self, 0, false); // durations need every tick
+    }
+    ForwarderCtx* forwarder_ctx = NULL;
+    if (forwarder) {
+        forwarder_ctx = new_shared_worker_ctx(sizeof(SharedUsage*), watchdog_ctx, &logger_ctx->self);
+        forwarder_ctx->forwarder    = forwarder;
+        forwarder_ctx->subscription = bus_subscribe(&bus, "Forwarder", &forwarder_ctx->self, 1, false); // the latest is all that counts
+    }
     
+    pthread_attr_t attr; // the same placement and scheduling for every one of them
+    tuned_attr_init(&attr, &options->tuning);
     pthread_t workers[NUM_WORKERS + 1];
-    thr_spawn(workers + LOGGER, logger_work, logger_ctx);
-    thr_spawn(workers + PRINTER, printer_work, printer_ctx);
-    thr_spawn(workers + ANALYZER, analyzer_work, analyzer_ctx);
-    thr_spawn(workers + READER, reader_work, analyzer_ctx);
-    thr_spawn(workers + WATCHDOG, watchdog_work, watchdog_ctx);
+    thr_spawn(workers + LOGGER, logger_work, logger_ctx, &attr);
+    thr_spawn(workers + PRINTER, printer_work, printer_ctx, &attr);
+    thr_spawn(workers + ANALYZER, analyzer_work, analyzer_ctx, &attr);
+    thr_spawn(workers + READER, reader_work, analyzer_ctx, &attr);
+    thr_spawn(workers + WATCHDOG, watchdog_work, watchdog_ctx, &attr);
+    pthread_t exporter_thread;
+    if (exporter_ctx)
+        thr_spawn(&exporter_thread, exporter_work, exporter_ctx, &attr);
+    pthread_t alerter_thread;
+    if (alerter_ctx)
+        thr_spawn(&alerter_thread, alerter_work, alerter_ctx, &attr);
+    pthread_t forwarder_thread;
+    if (forwarder_ctx)
+        thr_spawn(&forwarder_thread, forwarder_work, forwarder_ctx, &attr);
+    PTHREAD_CHECK(pthread_attr_destroy, pthread_attr_destroy(&attr));
 
     thr_join(workers[READER], NULL);
     thr_join(workers[ANALYZER], NULL);
     thr_join(workers[PRINTER], NULL);
     thr_join(workers[LOGGER], NULL);
     thr_join(workers[WATCHDOG], NULL);
+    if (exporter_ctx)
+        thr_join(exporter_thread, NULL);
+    if (alerter_ctx)
+        thr_join(alerter_thread, NULL);
+    if (forwarder_ctx)
+        thr_join(forwarder_thread, NULL);
 
     // the workers' queues might not be empty at this point, so we need to drain them
     // the following lines will do just that, and a bit more
     destroy_logger_ctx(logger_ctx);
-    destroy_printer_ctx(printer_ctx);
+    bus_destroy(&bus);
+    destroy_subscriber_ctx(printer_ctx);
+    if (exporter_ctx) {
+        destroy_exporter(exporter_ctx->exporter);
+        destroy_subscriber_ctx(exporter_ctx);
+    }
+    if (alerter_ctx)
+        destroy_subscriber_ctx(alerter_ctx);
+    if (forwarder_ctx)
+        destroy_subscriber_ctx(forwarder_ctx);
     destroy_analyzer_ctx(analyzer_ctx);
     destroy_watchdog_ctx(watchdog_ctx);
+    shutdown_destroy();
+}
+
+// the shards get the same placement and scheduling as every other worker
+static AnalyzerPool* new_tuned_analyzer_pool(const Options * const options, const CpuTopology * const topology) {
+    pthread_attr_t attr;
+    tuned_attr_init(&attr, &options->tuning);
+    AnalyzerPool* pool = new_analyzer_pool(options->analyzer_threads, topology, &attr);
+    PTHREAD_CHECK(pthread_attr_destroy, pthread_attr_destroy(&attr));
+    return pool;
+}
+
+// what the binary frames go by, both the forwarded and the printed ones
+static void get_host_name(const Options * const options, char host[FRAME_MAX_HOST_LEN + 1]) {
+    if (options->host_name)
+        checked_snprintf(host, FRAME_MAX_HOST_LEN + 1, "%s", options->host_name);
+    else if (gethostname(host, FRAME_MAX_HOST_LEN + 1) < 0)
+        fatal("gethostname");
+    host[FRAME_MAX_HOST_LEN] = '\0'; // gethostname needn't terminate a truncated name
+}
+
+int main(int argc, char* argv[]) {
+#ifndef __linux__
+    fatal("CUT (CPU Usage Tracker) only works on Linux!");
+#else
+    Options options = parse_options(argc, argv);
+    tune_process(&options.tuning);
+    logger_init(true);
+    ReaderConfig reader_config = {
+        .observe_self    = options.observe_self,
+        .adaptive        = options.adaptive,
+        .interval_micros = options.interval_micros,
+        .synthetic_cpus  = options.synthetic_cpus,
+        .irqs            = options.irqs,
+    };
+    reader_init(&reader_config);
+
+    CpuTopology* topology = get_topology(); // cpus don't move between sockets, once is enough
+    Analysis analysis = {
+        .topology      = topology,
+        .shm           = options.shm_name ? new_usage_shm(options.shm_name, topology) : NULL,
+        .subtract_self = options.subtract_self,
+        .pool          = options.analyzer_threads > 1 ? new_tuned_analyzer_pool(&options, topology) : NULL,
+    };
+    AlertEngine* alerts   = options.num_alert_rules
+        ? new_alert_engine(options.alert_rules, options.num_alert_rules, topology, open_alert_sink(options.alert_out))
+        : NULL;
+    char host[FRAME_MAX_HOST_LEN + 1];
+    get_host_name(&options, host);
+    Forwarder* forwarder  = options.forward_addr ? new_forwarder(options.forward_addr, host) : NULL;
+    Output* output        = new_output(open_output(options.output_path), options.output_format, host);
+
+    if (options.reactor) {
+        Exporter* exporter = options.exporter_addr ? new_exporter(options.exporter_addr) : NULL;
+        tune_current_thread(&options.tuning);
+        run_reactor(&analysis, output, exporter, alerts, forwarder);
+        if (exporter)
+            destroy_exporter(exporter);
+    } else {
+        run_threads(&options, &analysis, output, alerts, forwarder);
+    }
+
+    if (alerts)
+        destroy_alert_engine(alerts);
+    if (forwarder)
+        destroy_forwarder(forwarder);
+    destroy_output(output);
+    if (analysis.pool)
+        destroy_analyzer_pool(analysis.pool);
+    if (analysis.shm)
+        usage_shm_destroy(analysis.shm);
+    free_topology(topology);
 
     fprintf(stderr, "[Main] shutting down...\n");
+    reader_destroy();
     logger_destroy();
     return 0;
 #endif /*__linux__*/
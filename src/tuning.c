@@ -0,0 +1,71 @@
+#define _GNU_SOURCE // cpu_set_t and the affinity calls
+
+#include "tuning.h"
+
+#include "err.h"
+#include "util.h"
+#include "pthread_util.h"
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+
+// a cpu the kernel has never heard of is an error, not something to silently drop
+static void housekeeping_set(const char * const pin_list, cpu_set_t * const set) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (num_cpus < 0)
+        fatal("sysconf");
+    bool mask[num_cpus];
+    errno = 0; // not a system error
+    if (parse_cpu_list(pin_list, mask, num_cpus) == 0)
+        vfatal("no usable cpus in %s", pin_list);
+    CPU_ZERO(set);
+    for (long cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; ++cpu)
+        if (mask[cpu])
+            CPU_SET(cpu, set);
+}
+
+// threads inherit the nice value of the one that created them, so it's set once, before any is spawned;
+// the main thread is pinned here too, the workers get their placement from their attributes
+void tune_process(const ThreadTuning * const tuning) {
+    if (tuning->pin_list) {
+        cpu_set_t set;
+        housekeeping_set(tuning->pin_list, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            vfatal("failed to pin to %s", tuning->pin_list);
+    }
+    if (tuning->nice != 0 && setpriority(PRIO_PROCESS, 0, tuning->nice) < 0)
+        vfatal("failed to set the nice level to %d", tuning->nice);
+}
+
+void tuned_attr_init(pthread_attr_t * const attr, const ThreadTuning * const tuning) {
+    PTHREAD_CHECK(pthread_attr_init, pthread_attr_init(attr));
+    if (tuning->pin_list) {
+        cpu_set_t set;
+        housekeeping_set(tuning->pin_list, &set);
+        PTHREAD_CHECK(pthread_attr_setaffinity_np, pthread_attr_setaffinity_np(attr, sizeof(set), &set));
+    }
+    if (tuning->fifo_priority > 0) {
+        struct sched_param param = {.sched_priority = tuning->fifo_priority};
+        PTHREAD_CHECK(pthread_attr_setinheritsched, pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED));
+        PTHREAD_CHECK(pthread_attr_setschedpolicy, pthread_attr_setschedpolicy(attr, SCHED_FIFO));
+        PTHREAD_CHECK(pthread_attr_setschedparam, pthread_attr_setschedparam(attr, &param));
+    }
+    if (tuning->stack_size > 0)
+        PTHREAD_CHECK(pthread_attr_setstacksize, pthread_attr_setstacksize(attr, MAX(tuning->stack_size, (size_t)PTHREAD_STACK_MIN)));
+}
+
+// for the reactor, which does all of its work on the main thread
+void tune_current_thread(const ThreadTuning * const tuning) {
+    if (tuning->pin_list) {
+        cpu_set_t set;
+        housekeeping_set(tuning->pin_list, &set);
+        PTHREAD_CHECK(pthread_setaffinity_np, pthread_setaffinity_np(pthread_self(), sizeof(set), &set));
+    }
+    if (tuning->fifo_priority > 0) {
+        struct sched_param param = {.sched_priority = tuning->fifo_priority};
+        PTHREAD_CHECK(pthread_setschedparam, pthread_setschedparam(pthread_self(), SCHED_FIFO, &param));
+    }
+}
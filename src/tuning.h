@@ -0,0 +1,17 @@
+#pragma once
+
+// How the tracker's own threads are placed and scheduled, so that they stay off the cpus being measured.
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct {
+    const char* pin_list; // a kernel-style cpu list ("0-1,4") of housekeeping cpus, NULL to float
+    int fifo_priority;    // 0 keeps the default policy
+    int nice;
+    size_t stack_size;    // 0 for the default
+} ThreadTuning;
+
+void tune_process(const ThreadTuning * const tuning);
+void tuned_attr_init(pthread_attr_t * const attr, const ThreadTuning * const tuning);
+void tune_current_thread(const ThreadTuning * const tuning);
@@ -2,8 +2,12 @@
 
 #include "err.h"
 
+#include <sys/signalfd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
 
 size_t checked_snprintf(char * const buffer, const size_t max_len, const char * const format, ...) {
     va_list args;
@@ -23,3 +27,70 @@ void checked_fprintf(FILE * const stream, const char * const format, ...) {
         fatal("vfprintf");
     va_end(args);
 }
+
+// for sysfs/procfs one-liners; a missing file is not an error, it's just absent info
+bool read_small_file(const char * const path, char * const buffer, const size_t max_len) {
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+    size_t nread = fread(buffer, 1, max_len - 1, file);
+    buffer[nread] = '\0';
+    fclose(file);
+    return nread > 0;
+}
+
+// parses the kernel's cpu list format (e.g. "0-3,8,10-11\n") into a mask, returns the number of cpus set
+long parse_cpu_list(const char * const list, bool * const mask, const long length) {
+    for (long i = 0; i < length; ++i)
+        mask[i] = false;
+
+    long count = 0;
+    const char* pos = list;
+    while (*pos) {
+        char* end;
+        long first = strtol(pos, &end, 10);
+        if (end == pos)
+            break;
+        long last = first;
+        if (*end == '-') {
+            pos  = end + 1;
+            last = strtol(pos, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < length; ++cpu) {
+            if (cpu >= 0 && !mask[cpu]) {
+                mask[cpu] = true;
+                count++;
+            }
+        }
+        if (*end != ',')
+            break;
+        pos = end + 1;
+    }
+    return count;
+}
+
+// an option's number within [min, max], otherwise the usage and out
+long parse_long_option(const char * const text, const long min, const long max, const char * const usage_text,
+    const char * const prog_name) {
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, usage_text, prog_name);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+// SIGTERM and SIGINT for an event loop: blocked, and read from the fd instead
+int new_signal_fd() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        fatal("sigprocmask");
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+        fatal("signalfd");
+    return fd;
+}
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 size_t checked_snprintf(char * const buffer, const size_t max_len, const char * const format, ...);
 void checked_fprintf(FILE * const stream, const char * const format, ...);
+bool read_small_file(const char * const path, char * const buffer, const size_t max_len);
+long parse_cpu_list(const char * const list, bool * const mask, const long length);
+long parse_long_option(const char * const text, const long min, const long max, const char * const usage_text,
+    const char * const prog_name);
+int new_signal_fd();
@@ -0,0 +1,38 @@
+#include "watchdog.h"
+
+#include "util.h"
+#include "stats.h"
+
+void heartbeat_init(Heartbeat * const hb, const long deadline_millis) {
+    atomic_init(&hb->beats, 0);
+    atomic_init(&hb->waiting, false);
+    hb->deadline_millis = deadline_millis;
+    hb->last_beats      = 0;
+    hb->stalled         = false;
+    clock_gettime(CLOCK_MONOTONIC, &hb->last_progress);
+}
+
+static long millis_between(const struct timespec * const from, const struct timespec * const to) {
+    return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+// a worker is fine as long as its heartbeat moves or it's idly waiting for work,
+// otherwise it's reported (once per stall) when it overruns its deadline
+void check_heartbeat(Heartbeat * const hb, const char * const name, const struct timespec * const now) {
+    uint64_t beats = atomic_load_explicit(&hb->beats, memory_order_relaxed);
+    if (beats != hb->last_beats || atomic_load(&hb->waiting)) {
+        if (hb->stalled)
+            checked_fprintf(stderr, "[Watchdog] %s recovered after %.1f s\n", name, millis_between(&hb->last_progress, now) / 1000.0);
+        hb->last_beats    = beats;
+        hb->last_progress = *now;
+        hb->stalled       = false;
+        return;
+    }
+    long stalled_for = millis_between(&hb->last_progress, now);
+    if (!hb->stalled && stalled_for > hb->deadline_millis) {
+        checked_fprintf(stderr, "[Watchdog] %s has made no progress for %.1f s (deadline: %.1f s)\n",
+            name, stalled_for / 1000.0, hb->deadline_millis / 1000.0);
+        stat_inc(STAT_STALLS);
+        hb->stalled = true;
+    }
+}
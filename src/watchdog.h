@@ -0,0 +1,26 @@
+#pragma once
+
+// The watchdog's view of a worker: a heartbeat counter the worker bumps whenever it makes progress,
+// and a flag for when it's idly waiting for work, which is healthy however long it lasts.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    _Atomic uint64_t beats;  // bumped by the worker whenever it makes progress
+    _Atomic bool waiting;    // blocked on its condition with nothing to do, which is healthy
+    long deadline_millis;
+    // the rest is the watchdog's own bookkeeping
+    uint64_t last_beats;
+    struct timespec last_progress;
+    bool stalled;
+} Heartbeat;
+
+void heartbeat_init(Heartbeat * const hb, const long deadline_millis);
+void check_heartbeat(Heartbeat * const hb, const char * const name, const struct timespec * const now);
+
+static inline void heartbeat_beat(Heartbeat * const hb) {
+    atomic_fetch_add_explicit(&hb->beats, 1, memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#include "worker.h"
+
+#include "pthread_util.h"
+
+void init_worker_ctx(WorkerCtx * const ctx, const size_t queue_item_size) {
+    queue_init(&ctx->job_queue, queue_item_size);
+    mtx_init(&ctx->mtx);
+    cnd_init(&ctx->cnd);
+    ctx->wait = true;
+    ctx->upstream_done = false;
+}
+
+void destroy_worker_ctx(WorkerCtx * const ctx) {
+    queue_destroy(&ctx->job_queue);
+    mtx_destroy(&ctx->mtx);
+    cnd_destroy(&ctx->cnd);
+}
+
+void worker_push_back(WorkerCtx * const worker, const void * const item) {
+    mtx_lock(&worker->mtx);
+    worker_push_back_locked(worker, item);
+    mtx_unlock(&worker->mtx);
+}
+
+// for a pusher that holds the mutex already, e.g. to wait for room in a bounded queue first
+void worker_push_back_locked(WorkerCtx * const worker, const void * const item) {
+    queue_push_back(&worker->job_queue, item);
+    worker->wait = false;
+    cnd_signal(&worker->cnd);
+}
+
+// the worker still drains its queue before it stops
+void order_termination(WorkerCtx * const worker) {
+    mtx_lock(&worker->mtx);
+    worker->upstream_done = true;
+    cnd_signal(&worker->cnd);
+    mtx_unlock(&worker->mtx);
+}
+
+// called with the mutex held, which stays held if there's work to do; false once the worker upstream
+// is done and the queue is drained. The heartbeat, if any, is marked as waiting while there's nothing to do.
+bool should_continue_work(WorkerCtx * const self, Heartbeat * const hb) {
+    if (queue_empty(&self->job_queue))
+        self->wait = true;
+    if (hb)
+        atomic_store(&hb->waiting, true);
+    while (self->wait == true && !self->upstream_done)
+        cnd_wait(&self->cnd, &self->mtx);
+    if (hb) {
+        atomic_store(&hb->waiting, false);
+        heartbeat_beat(hb);
+    }
+    if (queue_empty(&self->job_queue)) {
+        mtx_unlock(&self->mtx);
+        return false;
+    }
+    return true;
+}
+
+// called with the mutex held, which stays held either way; false if neither work nor the end of it
+// came within the timeout, so that the worker can tend to its own chores meanwhile
+bool wait_for_work(WorkerCtx * const self, Heartbeat * const hb, const long timeout_millis) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_millis / 1000 + (deadline.tv_nsec + timeout_millis % 1000 * 1000000) / 1000000000;
+    deadline.tv_nsec  = (deadline.tv_nsec + timeout_millis % 1000 * 1000000) % 1000000000;
+
+    if (queue_empty(&self->job_queue))
+        self->wait = true;
+    if (hb)
+        atomic_store(&hb->waiting, true);
+    bool in_time = true;
+    while (self->wait == true && !self->upstream_done && in_time)
+        in_time = cnd_timed_wait(&self->cnd, &self->mtx, &deadline);
+    if (hb)
+        atomic_store(&hb->waiting, false);
+    return self->wait == false || self->upstream_done;
+}
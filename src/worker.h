@@ -0,0 +1,25 @@
+#pragma once
+
+#include "queue.h"
+#include "watchdog.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef struct { 
+    Queue job_queue;
+    bool wait;
+    bool upstream_done; // nothing more is going to be pushed, the worker stops once its queue is drained
+    pthread_mutex_t mtx;
+    pthread_cond_t cnd;
+} WorkerCtx;
+
+void init_worker_ctx(WorkerCtx * const ctx, const size_t queue_item_size);
+void destroy_worker_ctx(WorkerCtx * const ctx);
+
+// the handoff between workers: whoever pushes never waits for the worker, which sleeps on its condition until there's work
+void worker_push_back(WorkerCtx * const worker, const void * const item);
+void worker_push_back_locked(WorkerCtx * const worker, const void * const item);
+void order_termination(WorkerCtx * const worker);
+bool should_continue_work(WorkerCtx * const self, Heartbeat * const hb);
+bool wait_for_work(WorkerCtx * const self, Heartbeat * const hb, const long timeout_millis);